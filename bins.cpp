@@ -57,6 +57,11 @@ void binmap_t::extend () {
 
 binmap_t::binmap_t() :  height(4), blocks_allocated(0), cells(NULL), 
                 free_top(0), cells_allocated(0), twist_mask(0) {
+}
+
+void binmap_t::init () {
+    if (cells)
+        return;
     alloc_cell();
     assert( free_top == 1 );
 }
@@ -67,19 +72,25 @@ binmap_t::~binmap_t () {
 }
 
 void binmap_t::twist (uint64_t mask) {
+    init();
     while ( (1<<height) <= mask )
         extend_range();
     twist_mask = mask;
 }
 
 binmap_t::binmap_t (const binmap_t& b) : height(b.height), free_top(b.free_top),
-blocks_allocated(b.blocks_allocated), cells_allocated(b.cells_allocated) {
-    size_t memsz = blocks_allocated*16*32;
+blocks_allocated(b.blocks_allocated), cells_allocated(b.cells_allocated),
+twist_mask(b.twist_mask) {
+    cells = NULL;
+    if (!b.cells)
+        return;
+    size_t memsz = blocks_allocated*16*sizeof(uint32_t);
     cells = (uint32_t*) malloc(memsz);
     memcpy(cells,b.cells,memsz);
 }
 
 void binmap_t::dump (const char* note) {
+    init();
     printf("%s\t",note);
     for(int i=0; i<(blocks_allocated<<5); i++) {
         if ( (i&0x1f)>29 )
@@ -193,6 +204,7 @@ bin64_t iterator::next (bool stop_undeep, bool stop_solid, uint8_t stop_layer) {
 
 iterator::iterator(binmap_t* host_, bin64_t start, bool split) { 
     host = host_;
+    host->init();
     half = 0;
     for(int i=0; i<64; i++)
         history[i] = 1;
@@ -258,6 +270,8 @@ void iterator::parent () {
 
 
 bin64_t binmap_t::find (const bin64_t range, fill_t seek) {
+    if (!cells)
+        return seek==EMPTY ? range : bin64_t(bin64_t::NONE);
     iterator i(this,range,true);
     fill_t stop = seek==EMPTY ? FILLED : EMPTY;
     while (true) {
@@ -277,7 +291,7 @@ bin64_t binmap_t::find (const bin64_t range, fill_t seek) {
 
 
 uint16_t binmap_t::get (bin64_t bin) {
-    if (bin==bin64_t::NONE)
+    if (bin==bin64_t::NONE || !cells)
         return EMPTY;
     iterator i(this,bin,true);
     //while ( i.pos!=bin && 
@@ -290,11 +304,15 @@ uint16_t binmap_t::get (bin64_t bin) {
 
 
 void binmap_t::clear () {
+    if (!cells)
+        return;
     set(bin64_t(height,0),EMPTY);
 }
 
 
 uint64_t binmap_t::mass () {
+    if (!cells)
+        return 0;
     iterator i(this,bin64_t(0,0),false);
     uint64_t ret = 0;
     while (!i.solid())
@@ -309,7 +327,7 @@ uint64_t binmap_t::mass () {
 
 
 void binmap_t::set (bin64_t bin, fill_t val) {
-    if (bin==bin64_t::NONE)
+    if (bin==bin64_t::NONE || (!cells && val==EMPTY))
         return;
     assert(val==FILLED || val==EMPTY);
     iterator i(this,bin,false);
@@ -360,6 +378,8 @@ uint64_t*   binmap_t::get_stripes (int& count) {
 
 
 void    binmap_t::remove (binmap_t& b) {
+    if (!cells || !b.cells)
+        return;
     uint8_t start_lr = b.height>height ? b.height : height;
     bin64_t top(start_lr,0);
     iterator zis(this,top), zat(&b,top);
@@ -449,6 +469,8 @@ void        binmap_t::range_op (binmap_t& mask, bin64_t range, bin_op_t op) {
 }
 
 uint64_t    binmap_t::seq_length () {
+    if (!cells)
+        return 0;
     iterator i(this,bin64_t(height,0));
     if (!i.deep() && *i==FILLED)
         return i.pos.width();
@@ -463,6 +485,8 @@ uint64_t    binmap_t::seq_length () {
 
 
 bool        binmap_t::is_solid (bin64_t range, fill_t val)  {
+    if (!cells)
+        return val!=FILLED;
     if (range==bin64_t::ALL) 
         return !deep(0) && (is_mixed(val) || halves[0]==val);
     iterator i(this,range,false);
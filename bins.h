@@ -83,6 +83,9 @@ public:
 
     /** Return the number of cells allocated in the binmap. */
     uint32_t    size() { return cells_allocated; }
+    /** Return the number of bytes taken by the cells; none until the
+        binmap is first written to, as an empty one is all-0 anyway. */
+    uint32_t    bytes() const { return blocks_allocated*16*sizeof(uint32_t); }
     
     uint64_t    seq_length ();
     
@@ -141,6 +144,8 @@ private:
     uint16_t    free_top;
     
     void extend();
+    /** Allocate the root cell, if not yet. */
+    void init();
     
     static const uint8_t    SPLIT[16];
     static const uint8_t    JOIN[16];
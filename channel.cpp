@@ -15,9 +15,15 @@
 #include <sys/mman.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+#ifdef __linux__
+#include <sys/prctl.h>
 #endif
 #include <sys/stat.h>
 #include <string.h>
+#include <new>
 
 //#include <glog/logging.h>
 #include "swift.h"
@@ -31,41 +37,153 @@ int Channel::MAX_REORDERING = 4;
 bool Channel::SELF_CONN_OK = false;
 swift::tint Channel::TIMEOUT = TINT_SEC*60;
 std::vector<Channel*> Channel::channels(1);
+std::vector<uint8_t> Channel::generations(1);
+std::deque<uint32_t> Channel::free_ids;
+void* Channel::free_slots = NULL;
+std::vector<Channel*> Channel::peer_index;
+int Channel::peer_indexed = 0;
 Address Channel::tracker;
-tbheap Channel::send_queue;
+timerwheel_t Channel::send_queue;
 FILE* Channel::debug_file = NULL;
 #include "ext/simple_selector.cpp"
 PeerSelector* Channel::peer_selector = new SimpleSelector();
 
 Channel::Channel    (FileTransfer* transfer, int socket, Address peer_addr) :
     transfer_(transfer), peer_(peer_addr), peer_channel_id_(0), pex_out_(0),
+    pex_out_seq_(0),
     socket_(socket==INVALID_SOCKET?Datagram::default_socket():socket), // FIXME
-    data_out_cap_(bin64_t::ALL), last_data_out_time_(0), last_data_in_time_(0),
+    last_data_out_time_(0), last_data_in_time_(0),
     own_id_mentioned_(false), next_send_time_(0), last_send_time_(0),
-    last_recv_time_(0), rtt_avg_(TINT_SEC), dev_avg_(0), dip_avg_(TINT_SEC),
-    data_in_dbl_(bin64_t::NONE), hint_out_size_(0),
-    cwnd_(1), send_interval_(TINT_SEC), send_control_(PING_PONG_CONTROL),
+    last_recv_time_(0), dip_avg_(TINT_SEC),
+    data_in_dbl_(bin64_t::NONE), have_out_offset_(0), hint_in_size_(0),
+    hint_out_size_(0),
+    send_interval_(TINT_SEC), send_control_(PING_PONG_CONTROL),
     sent_since_recv_(0), ack_rcvd_recent_(0), ack_not_rcvd_recent_(0),
-    last_loss_time_(0), owd_min_bin_(0), owd_min_bin_start_(NOW), 
-    owd_cur_bin_(0), dgrams_sent_(0), dgrams_rcvd_(0), 
-    data_in_(TINT_NEVER,bin64_t::NONE)
+    dgrams_sent_(0), dgrams_rcvd_(0), data_out_seq_(0),
+    data_out_acked_(-1)
 {
     if (peer_==Address())
         peer_ = tracker;
-    this->id_ = channels.size();
-    channels.push_back(this);
-    transfer_->hs_in_.push_back(id_);
-    for(int i=0; i<4; i++) {
-        owd_min_bins_[i] = TINT_NEVER;
-        owd_current_[i] = TINT_NEVER;
+    Session::Join(peer_,this);
+    dip_avg_ = session_->dip_avg_;
+    if (free_ids.empty()) {
+        this->id_ = channels.size();
+        assert(id_<(1<<ID_BITS));
+        channels.push_back(this);
+        generations.push_back(0);
+    } else {
+        this->id_ = free_ids.front();
+        free_ids.pop_front();
+        channels[id_] = this;
     }
+    send_timer_.owner = id_;
+    join_seq_ = ++transfer_->channels_joined_;
+    transfer_next_ = NULL;
+    transfer_prev_ = transfer_->channels_tail_;
+    if (transfer_prev_)
+        transfer_prev_->transfer_next_ = this;
+    else
+        transfer_->channels_head_ = this;
+    transfer_->channels_tail_ = this;
+    transfer_->channel_count_++;
+    if (peer_indexed>=peer_index.size()) { // rehash into twice the buckets
+        std::vector<Channel*> old(peer_index.size()?peer_index.size()*2:64,NULL);
+        old.swap(peer_index);
+        for(int b=0; b<old.size(); b++)
+            while (Channel* c = old[b]) {
+                old[b] = c->peer_next_;
+                Channel*& head = PeerBucket(c->peer_,c->transfer_);
+                c->peer_next_ = head;
+                head = c;
+            }
+    }
+    Channel*& bucket = PeerBucket(peer_,transfer_);
+    peer_next_ = bucket;
+    bucket = this;
+    peer_indexed++;
     Reschedule();
     dprintf("%s #%u init %s\n",tintstr(),id_,peer_.str());
 }
 
 
 Channel::~Channel () {
+    send_queue.cancel(&send_timer_);
+    if (transfer_prev_)
+        transfer_prev_->transfer_next_ = transfer_next_;
+    else
+        transfer_->channels_head_ = transfer_next_;
+    if (transfer_next_)
+        transfer_next_->transfer_prev_ = transfer_prev_;
+    else
+        transfer_->channels_tail_ = transfer_prev_;
+    transfer_->channel_count_--;
+    Channel** pp = &PeerBucket(peer_,transfer_);
+    while (*pp!=this)
+        pp = &(*pp)->peer_next_;
+    *pp = peer_next_;
+    peer_indexed--;
+    session_->Leave(this);
     channels[id_] = NULL;
+    generations[id_]++;
+    free_ids.push_back(id_);
+}
+
+
+Channel*&   Channel::PeerBucket (const Address& addr, const FileTransfer* ft) {
+    uint64_t key = addr.key() ^ ((uint64_t)ft->files_index_<<48);
+    key *= 0x9E3779B97F4A7C15ULL; // Fibonacci hashing: the top bits mix well
+    return peer_index[(key>>32) & (peer_index.size()-1)];
+}
+
+
+Channel*    Channel::PeerChannel (const Address& addr, FileTransfer* ft,
+                                  Channel* after) {
+    if (peer_index.empty())
+        return NULL;
+    uint64_t key = addr.key();
+    Channel* c = after ? after->peer_next_ : PeerBucket(addr,ft);
+    while (c && (c->transfer_!=ft || c->peer_.key()!=key))
+        c = c->peer_next_;
+    return c;
+}
+
+
+void*   Channel::operator new (size_t size) {
+    assert(size==sizeof(Channel));
+    if (!free_slots) { // slabs are never returned, just reused
+        char* slab = (char*) malloc(SLAB_CHANNELS*sizeof(Channel));
+        if (!slab)
+            throw std::bad_alloc();
+        for(int i=SLAB_CHANNELS-1; i>=0; i--) {
+            *(void**)(slab+i*sizeof(Channel)) = free_slots;
+            free_slots = slab+i*sizeof(Channel);
+        }
+    }
+    void* slot = free_slots;
+    free_slots = *(void**)slot;
+    return slot;
+}
+
+
+void    Channel::operator delete (void* p) {
+    if (!p)
+        return;
+    *(void**)p = free_slots;
+    free_slots = p;
+}
+
+
+size_t  Channel::footprint () const {
+    // a tree node is three links and a colour on top of the value
+    const size_t node = 4*sizeof(void*);
+    return sizeof(Channel) +
+        ack_in_.bytes() + hash_out_.bytes() + have_out_.bytes() +
+        hint_out_map_.bytes() +
+        data_in_.heap_bytes() + data_out_.heap_bytes() +
+        data_out_tmo_.heap_bytes() + hint_in_.heap_bytes() +
+        hint_out_.heap_bytes() +
+        data_out_idx_.size() * (node+sizeof(std::pair<bin64_t,uint64_t>)) +
+        data_out_tmo_idx_.size() * (node+sizeof(std::pair<bin64_t,tint>));
 }
 
 
@@ -90,6 +208,54 @@ int     swift::Listen (Address addr) {
 }
 
 
+#if !defined(_WIN32) && defined(SO_REUSEPORT)
+static void reap_shards (int sig) {
+    int saved = errno;
+    while (waitpid(-1,NULL,WNOHANG)>0);
+    errno = saved;
+}
+#endif
+
+
+int     swift::Shard (int count) {
+#if !defined(_WIN32) && defined(SO_REUSEPORT)
+    if (count<2)
+        return 0;
+    if (Datagram::default_socket()!=INVALID_SOCKET) {
+        eprintf("shards must be forked before listening\n");
+        return 0;
+    }
+    Datagram::reuse_port = true;
+    // shards that are done (e.g. with -w) are not to linger as zombies
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler = reap_shards;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD,&sa,NULL);
+    pid_t parent = getpid();
+    fflush(NULL); // or the buffered output gets duplicated
+    for(int i=1; i<count; i++) {
+        pid_t pid = fork();
+        if (pid<0) {
+            print_error("cannot fork a shard");
+            break;
+        }
+        if (pid==0) {
+            signal(SIGCHLD,SIG_DFL);
+#ifdef __linux__
+            prctl(PR_SET_PDEATHSIG, SIGTERM); // die with the first shard
+            if (getppid()!=parent) // it died before we asked
+                _exit(0);
+#endif
+            return i;
+        }
+    }
+#endif
+    return 0;
+}
+
+
 void    swift::Shutdown (int sock_des) {
     Datagram::Shutdown();
 }
@@ -101,8 +267,8 @@ void    swift::Loop (tint till) {
 
 
 
-FileTransfer*   swift::Open (const char* filename, const Sha1Hash& hash) {
-    FileTransfer* ft = new FileTransfer(filename, hash);
+FileTransfer*   swift::Open (const char* filename, const Sha1Hash& hash, uint32_t chunk_size) {
+    FileTransfer* ft = new FileTransfer(filename, hash, chunk_size);
     if (ft && ft->file().data_storage()) {
 
         /*if (FileTransfer::files.size()<fdes)  // FIXME duplication
@@ -20,6 +20,7 @@
 #else
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #endif
 
 namespace swift {
@@ -146,10 +147,17 @@ tint usec_time(void)
 	return usec;
 }
 
+tint usec_walltime(void)
+{
+    struct _timeb t;
+    _ftime(&t);
+    return (tint)t.time*1000000 + (tint)t.millitm*1000;
+}
+
 
 #else
 
-tint usec_time(void)
+tint usec_walltime(void)
 {
     struct timeval t;
     gettimeofday(&t,NULL);
@@ -160,6 +168,23 @@ tint usec_time(void)
     return ret;
 }
 
+tint usec_time(void)
+{
+#ifdef CLOCK_MONOTONIC
+    // wall clock steps must not show up as negative RTTs; the offset
+    // taken at startup keeps the numbers (and the logs) wall-clock-like
+    static tint offset = 0;
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    tint ret = (tint)t.tv_sec*1000000 + t.tv_nsec/1000;
+    if (!offset)
+        offset = usec_walltime() - ret;
+    return ret + offset;
+#else
+    return usec_walltime();
+#endif
+}
+
 #endif
 
 void LibraryInit(void)
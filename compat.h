@@ -110,8 +110,12 @@ int     inet_aton(const char *cp, struct in_addr *inp);
 
 std::string gettmpdir(void);
 
+/** Monotonic time, usec; starts at the wall clock time. */
 tint    usec_time ();
 
+/** Wall clock time, usec; may jump. */
+tint    usec_walltime ();
+
 bool    make_socket_nonblocking(SOCKET s);
 
 bool    close_socket (SOCKET sock);
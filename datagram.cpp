@@ -7,6 +7,7 @@
  *
  */
 #include <iostream>
+#include <algorithm>
 #include <errno.h>
 
 #ifdef _WIN32
@@ -19,6 +20,28 @@
 
 #include "datagram.h"
 #include "compat.h"
+#ifdef SWIFT_EPOLL
+    #include <sys/epoll.h>
+    #include <sys/syscall.h>
+#endif
+#ifdef SWIFT_URING
+    #include <sys/mman.h>
+    #include <linux/io_uring.h>
+    #include <linux/swab.h>
+    #include <endian.h>
+#endif
+#ifdef SWIFT_UDP_OFFLOAD
+    #include <netinet/udp.h>
+    #ifndef SOL_UDP
+        #define SOL_UDP 17
+    #endif
+    #ifndef UDP_SEGMENT
+        #define UDP_SEGMENT 103
+    #endif
+    #ifndef UDP_GRO
+        #define UDP_GRO 104
+    #endif
+#endif
 
 namespace swift {
 
@@ -27,9 +50,325 @@ tint Datagram::start = now;
 tint Datagram::epoch = now/360000000LL*360000000LL; // make logs mergeable
 uint32_t Address::LOCALHOST = INADDR_LOOPBACK;
 uint64_t Datagram::dgrams_up=0, Datagram::dgrams_down=0,
-         Datagram::bytes_up=0, Datagram::bytes_down=0;
-sckrwecb_t Datagram::sock_open[] = {};
-int Datagram::sock_count = 0;
+         Datagram::bytes_up=0, Datagram::bytes_down=0,
+         Datagram::recv_batches=0;
+uint64_t Datagram::dgrams_dropped = 0;
+std::vector<sckrwecb_t> Datagram::sock_open;
+std::vector<uint8_t*> Datagram::buf_pool; // before any static Datagram
+Datagram Datagram::send_batch[DGRAM_SEND_BATCH];
+int Datagram::send_batch_size = 0;
+bool Datagram::send_batch_open = false;
+bool Datagram::offload = false;
+bool Datagram::reuse_port = false;
+
+#ifdef SWIFT_UDP_OFFLOAD
+#define DGRAM_GRO_BUFS 8
+#define DGRAM_GRO_BUFSZ (1<<16)
+/** Coalesced buffers received by the last recvmmsg() in GRO mode; they
+    are split into datagrams as Recv() callers ask for more. */
+static uint8_t gro_buf[DGRAM_GRO_BUFS][DGRAM_GRO_BUFSZ];
+static Address gro_addr[DGRAM_GRO_BUFS];
+static int gro_len[DGRAM_GRO_BUFS], gro_seg[DGRAM_GRO_BUFS];
+static tint gro_arrival[DGRAM_GRO_BUFS];
+static int gro_count = 0, gro_cur = 0, gro_off = 0;
+/** Cleared once the kernel refuses a GSO send. */
+static bool gso_works = true;
+
+/** Segment size of an offloaded send, carried in a cmsg. */
+union gso_cmsg_t {
+    struct cmsghdr hdr;
+    char space[CMSG_SPACE(sizeof(int))];
+};
+#endif
+
+#ifdef __linux__
+/** Ancillary data of a received datagram: the kernel timestamp, the
+    socket's drop count and, for a coalesced buffer, the segment size. */
+union recv_cmsg_t {
+    struct cmsghdr hdr;
+    char space[CMSG_SPACE(sizeof(struct timespec))+CMSG_SPACE(sizeof(uint32_t))+
+               CMSG_SPACE(sizeof(int))];
+};
+
+/** Buffer sizing state of a bound socket; what the kernel gets to see
+    and what has passed since it was last sized. */
+struct sockbuf_t {
+    int         rcvbuf, sndbuf;
+    uint32_t    drops, drops_sized;
+    tint        drop_time, sized_at;
+    uint64_t    bytes_in, bytes_out;
+    int         send_fails;
+};
+/** fd => buffer state; rcvbuf is 0 for sockets not bound by Bind(). */
+static std::vector<sockbuf_t> sock_buf;
+
+static bool set_sock_buf (SOCKET fd, int opt, int force_opt, int size) {
+    // the privileged can go beyond net.core.[rw]mem_max
+    if (setsockopt(fd,SOL_SOCKET,force_opt,(setsockoptptr_t)&size,sizeof(int))==0)
+        return true;
+    return setsockopt(fd,SOL_SOCKET,opt,(setsockoptptr_t)&size,sizeof(int))==0;
+}
+
+/** Halve/double the buffer to get closer to the target size. */
+static int resize_buf (int size, uint64_t target, bool overflow) {
+    if (overflow || target>size)
+        size *= 2;
+    else if (target*4<size)
+        size /= 2;
+    if (size<DGRAM_BUF_MIN)
+        size = DGRAM_BUF_MIN;
+    if (size>DGRAM_BUF_MAX)
+        size = DGRAM_BUF_MAX;
+    return size;
+}
+
+/** Accounts the socket's drop count as reported by the kernel. */
+static void note_drops (SOCKET sock, uint32_t drops) {
+    sockbuf_t& b = sock_buf[sock];
+    if ((int32_t)(drops-b.drops)<=0) // stamped before the last one we saw
+        return;
+    Datagram::dgrams_dropped += drops-b.drops;
+    b.drops = drops;
+    b.drop_time = Datagram::now;
+}
+
+/** Adapts the socket buffers to the traffic seen since the last time. */
+static void size_sock_buf (SOCKET sock) {
+    sockbuf_t& b = sock_buf[sock];
+    tint period = Datagram::now - b.sized_at;
+    bool overflow = b.drops!=b.drops_sized;
+    // overflows are answered sooner, but not on every datagram
+    if ( period<DGRAM_BUF_PERIOD &&
+         !( (overflow || b.send_fails) && period>=DGRAM_BUF_PERIOD/8 ) )
+        return;
+    int rcvbuf = resize_buf(b.rcvbuf,b.bytes_in*DGRAM_BUF_DEPTH/period,overflow);
+    int sndbuf = resize_buf(b.sndbuf,b.bytes_out*DGRAM_BUF_DEPTH/period,
+                            b.send_fails>0);
+    if (rcvbuf!=b.rcvbuf && set_sock_buf(sock,SO_RCVBUF,SO_RCVBUFFORCE,rcvbuf))
+        b.rcvbuf = rcvbuf;
+    if (sndbuf!=b.sndbuf && set_sock_buf(sock,SO_SNDBUF,SO_SNDBUFFORCE,sndbuf))
+        b.sndbuf = sndbuf;
+    b.drops_sized = b.drops;
+    b.sized_at = Datagram::now;
+    b.bytes_in = b.bytes_out = 0;
+    b.send_fails = 0;
+}
+
+/** Accounts a batch of datagrams received; drops is the highest drop
+    count they reported. */
+static void note_recv (SOCKET sock, uint64_t bytes, uint32_t drops) {
+    if (sock<0 || sock>=sock_buf.size() || !sock_buf[sock].rcvbuf)
+        return;
+    sock_buf[sock].bytes_in += bytes;
+    note_drops(sock,drops);
+    size_sock_buf(sock);
+}
+
+static uint32_t known_drops (SOCKET sock) {
+    return sock>=0 && sock<sock_buf.size() ? sock_buf[sock].drops : 0;
+}
+#endif
+
+/** Feeds the buffer sizing; refused is for sends that failed for lack
+    of buffer space. */
+static void note_send (SOCKET sock, int bytes, bool refused) {
+#ifdef __linux__
+    if (sock<0 || sock>=sock_buf.size() || !sock_buf[sock].rcvbuf)
+        return;
+    sock_buf[sock].bytes_out += bytes;
+    if (refused)
+        sock_buf[sock].send_fails++;
+#endif
+}
+
+static bool send_refused () {
+    return errno==EAGAIN || errno==EWOULDBLOCK || errno==ENOBUFS;
+}
+
+#ifdef __linux__
+/** Fills in the arrival time (unless there is no timestamp), the drop
+    count (unless there were none) and the GRO segment size (unless the
+    buffer is not coalesced). The arrival time is the read time on
+    entry; the kernel stamps datagrams with the wall clock, which is
+    wall_skew ahead of ours. */
+static void parse_recv_cmsg (struct msghdr* hdr, tint wall_skew,
+                             tint* arrival, uint32_t* drops, int* segment) {
+    for(struct cmsghdr* cm=CMSG_FIRSTHDR(hdr); cm; cm=CMSG_NXTHDR(hdr,cm)) {
+#ifdef SO_RXQ_OVFL
+        if (cm->cmsg_level==SOL_SOCKET && cm->cmsg_type==SO_RXQ_OVFL)
+            memcpy(drops,CMSG_DATA(cm),sizeof(uint32_t));
+#endif
+#ifdef SCM_TIMESTAMPNS
+        if (cm->cmsg_level==SOL_SOCKET && cm->cmsg_type==SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts,CMSG_DATA(cm),sizeof(ts));
+            tint stamp = (tint)ts.tv_sec*TINT_SEC + ts.tv_nsec/1000 - wall_skew;
+            if (stamp<*arrival) // not if the wall clock was stepped back
+                *arrival = stamp;
+        }
+#endif
+#ifdef SWIFT_UDP_OFFLOAD
+        if (cm->cmsg_level==SOL_UDP && cm->cmsg_type==UDP_GRO)
+            *segment = *(int*)CMSG_DATA(cm);
+#endif
+    }
+}
+#endif
+
+const char* Datagram::BACKEND_NAMES[] = {"select", "epoll", "io_uring"};
+#ifdef SWIFT_EPOLL
+Datagram::backend_t Datagram::backend = EPOLL_BACKEND;
+#else
+Datagram::backend_t Datagram::backend = SELECT_BACKEND;
+#endif
+static bool backend_picked = false;
+
+#ifdef SWIFT_EPOLL
+#define DGRAM_MAX_EPOLL_EVENTS 64
+/** The epoll instance all the sockets are registered with. */
+static int epoll_fd = -1;
+/** fd => index in sock_open (or -1); makes the dispatch O(ready). */
+static std::vector<int> sock_slot;
+/** fd => registration serial; events for a closed and reused fd
+    number are recognized as stale and dropped. */
+static std::vector<uint32_t> sock_serial;
+static uint32_t last_serial = 0;
+
+/** EPOLL* flags have the values of POLL* ones, so io_uring polls use
+    the same mask. */
+static uint32_t epoll_mask (const sckrwecb_t& cb) {
+    return (cb.may_read ? EPOLLIN : 0) | (cb.may_write ? EPOLLOUT : 0) |
+           (cb.on_error ? EPOLLPRI : 0);
+}
+
+static uint64_t event_tag (SOCKET sock) {
+    return ((uint64_t)sock_serial[sock]<<32) | sock;
+}
+#endif
+
+#ifdef SWIFT_URING
+#define DGRAM_URING_ENTRIES 256
+/** A bare io_uring, mapped the way io_uring_setup(2) describes. Every
+    socket has a one-shot poll in flight; it is re-armed after its
+    completion is dispatched, so readiness is level-triggered as with
+    epoll. New polls are submitted with the next Wait() in one go. */
+static struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    /** The two mappings, to unmap on shutdown. */
+    void*  ring;
+    size_t ring_size;
+    size_t sqes_size;
+} uring = {-1};
+/** fd => whether a poll is in flight. */
+static std::vector<bool> sock_armed;
+
+static int uring_enter (unsigned to_submit, unsigned min_complete,
+                        unsigned flags, void* arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter,uring.fd,to_submit,min_complete,
+                   flags,arg,argsz);
+}
+
+static unsigned uring_unsubmitted () {
+    return *uring.sq_tail - __atomic_load_n(uring.sq_head,__ATOMIC_ACQUIRE);
+}
+
+static bool uring_setup () {
+    struct io_uring_params p;
+    memset(&p,0,sizeof(p));
+    int fd = syscall(__NR_io_uring_setup,DGRAM_URING_ENTRIES,&p);
+    if (fd<0)
+        return false;
+    // timed waits need IORING_ENTER_EXT_ARG (Linux 5.11)
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(fd);
+        return false;
+    }
+    size_t sq_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    size_t ring_size = sq_size>cq_size ? sq_size : cq_size;
+    size_t sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    uint8_t* ring = (uint8_t*) mmap(0,ring_size,PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+    void* sqes = mmap(0,sqes_size,PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES);
+    if (ring==MAP_FAILED || sqes==MAP_FAILED) {
+        if (ring!=MAP_FAILED)
+            munmap(ring,ring_size);
+        if (sqes!=MAP_FAILED)
+            munmap(sqes,sqes_size);
+        close(fd);
+        return false;
+    }
+    uring.fd = fd;
+    uring.ring = ring;
+    uring.ring_size = ring_size;
+    uring.sqes_size = sqes_size;
+    uring.sq_head = (unsigned*)(ring+p.sq_off.head);
+    uring.sq_tail = (unsigned*)(ring+p.sq_off.tail);
+    uring.sq_mask = (unsigned*)(ring+p.sq_off.ring_mask);
+    uring.sq_array = (unsigned*)(ring+p.sq_off.array);
+    uring.cq_head = (unsigned*)(ring+p.cq_off.head);
+    uring.cq_tail = (unsigned*)(ring+p.cq_off.tail);
+    uring.cq_mask = (unsigned*)(ring+p.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe*)(ring+p.cq_off.cqes);
+    uring.sq_entries = p.sq_entries;
+    uring.sqes = (struct io_uring_sqe*)sqes;
+    return true;
+}
+
+/** Get a blank SQE; it is submitted once uring_push() publishes it. */
+static struct io_uring_sqe* uring_sqe () {
+    if (uring_unsubmitted()==uring.sq_entries && // full, flush
+            uring_enter(uring.sq_entries,0,0,NULL,0)<0)
+        print_error("io_uring submission fails");
+    struct io_uring_sqe* sqe = uring.sqes + (*uring.sq_tail & *uring.sq_mask);
+    memset(sqe,0,sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+static void uring_push () {
+    unsigned tail = *uring.sq_tail;
+    uring.sq_array[tail & *uring.sq_mask] = tail & *uring.sq_mask;
+    __atomic_store_n(uring.sq_tail,tail+1,__ATOMIC_RELEASE);
+}
+
+static void uring_arm (const sckrwecb_t& cb) {
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = cb.sock;
+    // sockets wake pollers with POLLPRI set along with POLLIN, and the
+    // poll completes with that as is; ERR/HUP are reported regardless
+    uint32_t events = epoll_mask(cb) & ~EPOLLPRI;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    events = __swahw32(events); // the kernel reads it as two halves
+#endif
+    sqe->poll32_events = events;
+    sqe->user_data = event_tag(cb.sock);
+    uring_push();
+    if (cb.sock>=sock_armed.size())
+        sock_armed.resize(cb.sock+1,false);
+    sock_armed[cb.sock] = true;
+}
+
+/** Cancel the poll in flight; its completion becomes stale as the
+    caller changes or clears the serial. */
+static void uring_disarm (SOCKET sock) {
+    if (sock>=sock_armed.size() || !sock_armed[sock])
+        return;
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = event_tag(sock);
+    sqe->user_data = 0;
+    uring_push();
+    sock_armed[sock] = false;
+}
+#endif
 
 const char* tintstr (tint time) {
     if (time==0)
@@ -88,40 +427,308 @@ Address::Address(const char* ip_port) {
 }
 
     
+int     Datagram::FindSocket (SOCKET sock) {
+#ifdef SWIFT_EPOLL
+    if (sock<0 || sock>=sock_slot.size())
+        return -1;
+    return sock_slot[sock];
+#else
+    for(int i=0; i<sock_open.size(); i++)
+        if (sock_open[i].sock==sock)
+            return i;
+    return -1;
+#endif
+}
+
+
+void    Datagram::AddSocket (const sckrwecb_t& cb) {
+    if (!backend_picked)
+        SelectBackend();
+#ifdef SWIFT_URING
+    // the ring is set up with the first socket, so that shards forked
+    // before binding get rings of their own; same for epoll
+    if (backend==URING_BACKEND && uring.fd==-1 && !uring_setup()) {
+        print_error("cannot set up io_uring, falling back to epoll");
+        backend = EPOLL_BACKEND;
+    }
+#endif
+#ifdef SWIFT_EPOLL
+    if (cb.sock>=sock_slot.size()) {
+        sock_slot.resize(cb.sock+1,-1);
+        sock_serial.resize(cb.sock+1,0);
+    }
+    sock_slot[cb.sock] = sock_open.size();
+    sock_serial[cb.sock] = ++last_serial;
+    if (backend==EPOLL_BACKEND) {
+        if (epoll_fd==-1 && (epoll_fd=epoll_create(DGRAM_MAX_EPOLL_EVENTS))<0)
+            print_error("cannot create epoll instance");
+        struct epoll_event ev;
+        ev.events = epoll_mask(cb);
+        ev.data.u64 = event_tag(cb.sock);
+        if (epoll_ctl(epoll_fd,EPOLL_CTL_ADD,cb.sock,&ev)!=0)
+            print_error("cannot add socket to epoll");
+    }
+#endif
+#ifdef SWIFT_URING
+    if (backend==URING_BACKEND)
+        uring_arm(cb);
+#endif
+    sock_open.push_back(cb);
+}
+
+
+void    Datagram::RemoveSocket (int i) {
+    SOCKET sock = sock_open[i].sock;
+    sock_open[i] = sock_open.back();
+    sock_open.pop_back();
+#ifdef SWIFT_EPOLL
+    if (i<sock_open.size())
+        sock_slot[sock_open[i].sock] = i;
+    sock_slot[sock] = -1;
+#ifdef SWIFT_URING
+    if (backend==URING_BACKEND)
+        uring_disarm(sock);
+#endif
+    sock_serial[sock] = 0;
+    if (backend==EPOLL_BACKEND) {
+        struct epoll_event ev; // the fd might be closed already; ENOENT/EBADF
+        epoll_ctl(epoll_fd,EPOLL_CTL_DEL,sock,&ev);
+    }
+#endif
+}
+
+    
 bool    Datagram::Listen3rdPartySocket (sckrwecb_t cb) {
-    int i=0;
-    while (i<sock_count && sock_open[i].sock!=cb.sock) i++;
-    if (i==sock_count)
-        if (i==DGRAM_MAX_SOCK_OPEN)
+    int i = FindSocket(cb.sock);
+    if (!cb.may_read && !cb.may_write && !cb.on_error) {
+        if (i!=-1)
+            RemoveSocket(i);
+        return true;
+    }
+    if (i==-1) {
+        AddSocket(cb);
+        return true;
+    }
+#ifdef SWIFT_URING
+    if (backend==URING_BACKEND && epoll_mask(cb)!=epoll_mask(sock_open[i]) &&
+            cb.sock<sock_armed.size() && sock_armed[cb.sock]) {
+        uring_disarm(cb.sock);
+        sock_serial[cb.sock] = ++last_serial;
+        uring_arm(cb);
+    } // if not armed, it gets armed with the new mask after the dispatch
+#endif
+#ifdef SWIFT_EPOLL
+    if (backend==EPOLL_BACKEND && epoll_mask(cb)!=epoll_mask(sock_open[i])) {
+        struct epoll_event ev;
+        ev.events = epoll_mask(cb);
+        ev.data.u64 = event_tag(cb.sock);
+        if (epoll_ctl(epoll_fd,EPOLL_CTL_MOD,cb.sock,&ev)!=0) {
+            print_error("cannot modify epoll registration");
             return false;
-        else
-            sock_count++;
+        }
+    }
+#endif
     sock_open[i]=cb;
-    //if (!cb.may_read && !cb.may_write && !cb.on_error)
-    //    sock_open[i] = sock_open[--sock_count];
     return true;
 }
 
     
 void Datagram::Shutdown () {
-    while (sock_count--)
-        Close(sock_open[sock_count].sock);
+    while (!sock_open.empty())
+        Close(sock_open.back().sock);
+#ifdef SWIFT_EPOLL
+    if (epoll_fd!=-1) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+#endif
+#ifdef SWIFT_URING
+    if (uring.fd!=-1) {
+        uring_enter(uring_unsubmitted(),0,0,NULL,0); // the removals
+        munmap(uring.sqes,uring.sqes_size);
+        munmap(uring.ring,uring.ring_size);
+        close(uring.fd);
+        uring.fd = -1;
+    }
+#endif
+}
+
+
+Datagram::backend_t Datagram::SelectBackend (backend_t best) {
+    backend_picked = true;
+    backend = SELECT_BACKEND;
+#ifdef SWIFT_URING
+    if (best>=URING_BACKEND) {
+        struct io_uring_params p;
+        memset(&p,0,sizeof(p));
+        int fd = syscall(__NR_io_uring_setup,1,&p); // just a probe
+        if (fd>=0) {
+            close(fd);
+            if ( (p.features & IORING_FEAT_EXT_ARG) &&
+                 (p.features & IORING_FEAT_SINGLE_MMAP) )
+                return backend = URING_BACKEND;
+        }
+    }
+#endif
+#ifdef SWIFT_EPOLL
+    if (best>=EPOLL_BACKEND) {
+        int fd = epoll_create(1);
+        if (fd>=0) {
+            close(fd);
+            return backend = EPOLL_BACKEND;
+        }
+    }
+#endif
+    return backend;
 }
     
 
 int Datagram::Send () {
+    if (send_batch_open) {
+        if (send_batch_size==DGRAM_SEND_BATCH) {
+            FlushSendBatch();
+            send_batch_open = true;
+        }
+        Datagram& q = send_batch[send_batch_size++];
+        q.sock = sock;
+        q.addr = addr;
+        q.offset = offset;
+        q.length = length;
+        std::swap(q.buf,buf); // no copying; we get the spare buffer
+        note_send(sock,size(),false);
+        dgrams_up++;
+        bytes_up+=size();
+        offset=0;
+        length=0;
+        return q.size();
+    }
     int r = sendto(sock,(const char *)buf+offset,length-offset,0,
                    (struct sockaddr*)&(addr.addr),sizeof(struct sockaddr_in));
     if (r<0)
         perror("can't send");
+    note_send(sock,size(),r<0 && send_refused());
     dgrams_up++;
     bytes_up+=size();
     offset=0;
     length=0;
-    Time();
     return r;
 }
 
+void Datagram::StartSendBatch () {
+    send_batch_open = true;
+}
+
+
+int Datagram::FlushSendBatch () {
+    int sent = 0;
+    bool done[DGRAM_SEND_BATCH];
+    memset(done,0,sizeof(done));
+    for(int i=0; i<send_batch_size; i++) {
+        if (done[i])
+            continue;
+        SOCKET sock = send_batch[i].sock;
+#ifdef __linux__
+        struct mmsghdr msgs[DGRAM_SEND_BATCH];
+        struct iovec iovs[DGRAM_SEND_BATCH];
+        int n = 0, v = 0;
+#ifdef SWIFT_UDP_OFFLOAD
+        gso_cmsg_t ctrl[DGRAM_SEND_BATCH];
+#else
+        bool gso_works = false;
+#endif
+        for(int j=i; j<send_batch_size; j++) {
+            if (done[j] || send_batch[j].sock!=sock)
+                continue;
+            Datagram& d = send_batch[j];
+            struct msghdr& hdr = msgs[n].msg_hdr;
+            memset(msgs+n,0,sizeof(struct mmsghdr));
+            hdr.msg_name = &(d.addr.addr);
+            hdr.msg_namelen = sizeof(struct sockaddr_in);
+            hdr.msg_iov = iovs+v;
+            int total = 0;
+            // with GSO, all the segments are of the same size except for
+            // the last one, which may be shorter
+            for(int k=j; k<send_batch_size; k++) {
+                Datagram& e = send_batch[k];
+                if (done[k] || e.sock!=sock || e.addr!=d.addr)
+                    continue;
+                if (k>j && (!offload || !gso_works || e.size()>d.size() ||
+                            hdr.msg_iovlen==DGRAM_GSO_SEGS ||
+                            total+e.size()>DGRAM_GSO_BYTES))
+                    break;
+                iovs[v].iov_base = e.buf+e.offset;
+                iovs[v].iov_len = e.size();
+                v++;
+                hdr.msg_iovlen++;
+                total += e.size();
+                done[k] = true;
+                if (e.size()<d.size())
+                    break;
+            }
+#ifdef SWIFT_UDP_OFFLOAD
+            if (hdr.msg_iovlen>1) {
+                hdr.msg_control = ctrl+n;
+                hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                struct cmsghdr* cm = CMSG_FIRSTHDR(&hdr);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                *(uint16_t*)CMSG_DATA(cm) = d.size();
+            }
+#endif
+            n++;
+        }
+        for(int m=0; m<n; ) {
+            int r = sendmmsg(sock,msgs+m,n-m,0);
+            if (r<=0 && msgs[m].msg_hdr.msg_control &&
+                (errno==EIO || errno==EINVAL || errno==EOPNOTSUPP)) {
+                // the route can't do GSO (e.g. no checksum offload);
+                // give up on it and send that buffer the usual way
+                print_error("segmentation offload fails");
+                gso_works = false;
+                struct msghdr& hdr = msgs[m].msg_hdr;
+                for(int k=0; k<hdr.msg_iovlen; k++)
+                    if (sendto(sock,(const char*)hdr.msg_iov[k].iov_base,
+                               hdr.msg_iov[k].iov_len,0,(struct sockaddr*)
+                               hdr.msg_name,hdr.msg_namelen)>=0)
+                        sent++;
+                    else
+                        note_send(sock,0,send_refused());
+                m++;
+                continue;
+            }
+            // a full send buffer is no reason to give up on GSO: the rest
+            // is lost, like with a failed sendto()
+            if (r<=0) {
+                note_send(sock,0,send_refused());
+                perror("can't send");
+                break;
+            }
+            for(int k=m; k<m+r; k++)
+                sent += msgs[k].msg_hdr.msg_iovlen;
+            m += r;
+        }
+#else
+        for(int j=i; j<send_batch_size; j++) {
+            if (done[j] || send_batch[j].sock!=sock)
+                continue;
+            Datagram& d = send_batch[j];
+            if (sendto(sock,(const char *)d.buf+d.offset,d.size(),0,
+                       (struct sockaddr*)&(d.addr.addr),sizeof(struct sockaddr_in))<0)
+                perror("can't send");
+            else
+                sent++;
+            done[j] = true;
+        }
+#endif
+    }
+    send_batch_size = 0;
+    send_batch_open = false;
+    Time();
+    return sent;
+}
+
+
 int Datagram::Recv () {
     socklen_t addrlen = sizeof(struct sockaddr_in);
     offset = 0;
@@ -133,12 +740,167 @@ int Datagram::Recv () {
     }
     dgrams_down++;
     bytes_down+=length;
-    Time();
+    arrival = Time();
     return length;
 }
 
 
+int Datagram::Recv (SOCKET socket, Datagram* dgrams, int count) {
+#ifdef SWIFT_UDP_OFFLOAD
+    if (offload || recv_pending()) {
+        int r = RecvSplit(socket,dgrams,count);
+        if (r)
+            recv_batches++;
+        return r;
+    }
+#endif
+#ifdef __linux__
+    struct mmsghdr msgs[DGRAM_RECV_BATCH];
+    struct iovec iovs[DGRAM_RECV_BATCH];
+    recv_cmsg_t ctrl[DGRAM_RECV_BATCH];
+    if (count>DGRAM_RECV_BATCH)
+        count = DGRAM_RECV_BATCH;
+    memset(msgs,0,sizeof(struct mmsghdr)*count);
+    for(int i=0; i<count; i++) {
+        iovs[i].iov_base = dgrams[i].buf;
+        iovs[i].iov_len = MAXDGRAMSZ*2;
+        msgs[i].msg_hdr.msg_name = &(dgrams[i].addr.addr);
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = iovs+i;
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = ctrl+i;
+        msgs[i].msg_hdr.msg_controllen = sizeof(recv_cmsg_t);
+    }
+    int r = recvmmsg(socket,msgs,count,MSG_DONTWAIT,NULL);
+    if (r<0) {
+        if (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR)
+            print_error("error on recv");
+        r = 0;
+    }
+    // one clock read per batch; the kernel timestamps are more precise
+    tint wall = usec_walltime(), read_at = Time();
+    uint32_t drops = known_drops(socket);
+    uint64_t bytes = 0;
+    for(int i=0; i<r; i++) {
+        int segment;
+        dgrams[i].sock = socket;
+        dgrams[i].offset = 0;
+        dgrams[i].length = msgs[i].msg_len;
+        dgrams[i].arrival = read_at;
+        parse_recv_cmsg(&msgs[i].msg_hdr,wall-read_at,
+                        &dgrams[i].arrival,&drops,&segment);
+        bytes += msgs[i].msg_len;
+    }
+    bytes_down += bytes;
+    dgrams_down += r;
+    note_recv(socket,bytes,drops);
+#else
+    int r = 0;
+    if (count>0) {
+        dgrams[0].sock = socket;
+        if (dgrams[0].Recv()>0)
+            r = 1;
+    }
+#endif
+    if (r)
+        recv_batches++;
+    return r;
+}
+
+
+bool Datagram::recv_pending () {
+#ifdef SWIFT_UDP_OFFLOAD
+    return gro_cur<gro_count;
+#else
+    return false;
+#endif
+}
+
+
+#ifdef SWIFT_UDP_OFFLOAD
+int Datagram::RecvSplit (SOCKET socket, Datagram* dgrams, int count) {
+    int r = 0;
+    bool refilled = false;
+    while (r<count) {
+        if (gro_cur==gro_count) { // all split; read more, once per call
+            if (refilled)
+                break;
+            refilled = true;
+            struct mmsghdr msgs[DGRAM_GRO_BUFS];
+            struct iovec iovs[DGRAM_GRO_BUFS];
+            recv_cmsg_t ctrl[DGRAM_GRO_BUFS];
+            memset(msgs,0,sizeof(msgs));
+            for(int i=0; i<DGRAM_GRO_BUFS; i++) {
+                iovs[i].iov_base = gro_buf[i];
+                iovs[i].iov_len = DGRAM_GRO_BUFSZ;
+                msgs[i].msg_hdr.msg_name = &(gro_addr[i].addr);
+                msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+                msgs[i].msg_hdr.msg_iov = iovs+i;
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_hdr.msg_control = ctrl+i;
+                msgs[i].msg_hdr.msg_controllen = sizeof(recv_cmsg_t);
+            }
+            int got = recvmmsg(socket,msgs,DGRAM_GRO_BUFS,MSG_DONTWAIT,NULL);
+            if (got<0) {
+                if (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR)
+                    print_error("error on recv");
+                break;
+            }
+            gro_count = got;
+            gro_cur = gro_off = 0;
+            tint wall = usec_walltime(), read_at = Time();
+            uint32_t drops = known_drops(socket);
+            uint64_t bytes = 0;
+            for(int i=0; i<got; i++) {
+                gro_len[i] = gro_seg[i] = msgs[i].msg_len;
+                gro_arrival[i] = read_at;
+                parse_recv_cmsg(&msgs[i].msg_hdr,wall-read_at,
+                                gro_arrival+i,&drops,gro_seg+i);
+                bytes += gro_len[i];
+            }
+            bytes_down += bytes;
+            note_recv(socket,bytes,drops);
+            continue;
+        }
+        if (gro_off>=gro_len[gro_cur] || gro_seg[gro_cur]<=0) { // empty one
+            gro_cur++;
+            gro_off = 0;
+            continue;
+        }
+        int len = gro_len[gro_cur]-gro_off;
+        if (len>gro_seg[gro_cur])
+            len = gro_seg[gro_cur];
+        Datagram& d = dgrams[r++];
+        d.sock = socket;
+        d.addr = gro_addr[gro_cur];
+        d.arrival = gro_arrival[gro_cur];
+        d.offset = 0;
+        d.length = len<MAXDGRAMSZ*2 ? len : MAXDGRAMSZ*2;
+        memcpy(d.buf,gro_buf[gro_cur]+gro_off,d.length);
+        gro_off += len;
+    }
+    dgrams_down += r;
+    return r;
+}
+#endif
+
+
 SOCKET Datagram::Wait (tint usec) {
+    if (usec<0)
+        usec = 0;
+    switch (backend) {
+#ifdef SWIFT_URING
+        case URING_BACKEND: return WaitUring(usec);
+#endif
+#ifdef SWIFT_EPOLL
+        case EPOLL_BACKEND: return WaitEpoll(usec);
+#endif
+        default:            return WaitSelect(usec);
+    }
+}
+
+
+SOCKET Datagram::WaitSelect (tint usec) {
     struct timeval timeout;
     timeout.tv_sec = usec/TINT_SEC;
     timeout.tv_usec = usec%TINT_SEC;
@@ -147,7 +909,7 @@ SOCKET Datagram::Wait (tint usec) {
     FD_ZERO(&rdfd);
     FD_ZERO(&wrfd);
     FD_ZERO(&errfd);
-    for(int i=0; i<sock_count; i++) {
+    for(int i=0; i<sock_open.size(); i++) {
         if (sock_open[i].may_read!=0)
             FD_SET(sock_open[i].sock,&rdfd);
         if (sock_open[i].may_write!=0)
@@ -160,8 +922,8 @@ SOCKET Datagram::Wait (tint usec) {
     SOCKET sel = select(max_sock_fd+1, &rdfd, &wrfd, &errfd, &timeout);
     Time();
     if (sel>0) {
-        for (int i=0; i<=sock_count; i++) {
-            sckrwecb_t& sct = sock_open[i];
+        for (int i=0; i<sock_open.size(); i++) {
+            sckrwecb_t sct = sock_open[i]; // callbacks may (un)register
             if (sct.may_read && FD_ISSET(sct.sock,&rdfd))
                 (*(sct.may_read))(sct.sock);
             if (sct.may_write && FD_ISSET(sct.sock,&wrfd))
@@ -176,6 +938,97 @@ SOCKET Datagram::Wait (tint usec) {
     return sel;
 }
 
+
+#ifdef SWIFT_EPOLL
+SOCKET Datagram::WaitEpoll (tint usec) {
+    struct epoll_event events[DGRAM_MAX_EPOLL_EVENTS];
+    if (epoll_fd==-1 && (epoll_fd=epoll_create(DGRAM_MAX_EPOLL_EVENTS))<0) {
+        print_error("cannot create epoll instance");
+        return -1;
+    }
+    int sel = -1;
+#ifdef __NR_epoll_pwait2
+    static bool have_pwait2 = true; // usec precision, Linux 5.11+
+    if (have_pwait2) {
+        struct timespec timeout;
+        timeout.tv_sec = usec/TINT_SEC;
+        timeout.tv_nsec = (usec%TINT_SEC)*1000;
+        sel = syscall(__NR_epoll_pwait2,epoll_fd,events,
+                      DGRAM_MAX_EPOLL_EVENTS,&timeout,NULL,0);
+        if (sel<0 && errno==ENOSYS)
+            have_pwait2 = false;
+    }
+    if (!have_pwait2)
+#endif
+        sel = epoll_wait(epoll_fd,events,DGRAM_MAX_EPOLL_EVENTS,
+                         (usec+TINT_MSEC-1)/TINT_MSEC);
+    Time();
+    for(int e=0; e<sel; e++)
+        DispatchEvents( (SOCKET)(events[e].data.u64 & 0xffffffff),
+                        events[e].data.u64 >> 32, events[e].events );
+    if (sel<0 && errno!=EINTR)
+        print_error("epoll fails");
+    return sel;
+}
+
+
+void Datagram::DispatchEvents (SOCKET sock, uint32_t serial, uint32_t ev) {
+    int i;
+    #define epoll_cb(cb) ( (i=FindSocket(sock))!=-1 && \
+        sock_serial[sock]==serial && sock_open[i].cb )
+    // same semantics as select(): errors/hangups make a socket readable
+    if ( (ev & (EPOLLIN|EPOLLERR|EPOLLHUP)) && epoll_cb(may_read) )
+        (*(sock_open[i].may_read))(sock);
+    if ( (ev & (EPOLLOUT|EPOLLERR)) && epoll_cb(may_write) )
+        (*(sock_open[i].may_write))(sock);
+    if ( (ev & EPOLLPRI) && epoll_cb(on_error) )
+        (*(sock_open[i].on_error))(sock);
+    // nobody cares about the hangup; unless told, it repeats forever
+    if ( (ev & (EPOLLERR|EPOLLHUP)) && !(ev & EPOLLPRI) &&
+         !epoll_cb(may_read) && !epoll_cb(may_write) && epoll_cb(on_error) )
+        (*(sock_open[i].on_error))(sock);
+    #undef epoll_cb
+}
+#endif
+
+
+#ifdef SWIFT_URING
+SOCKET Datagram::WaitUring (tint usec) {
+    struct __kernel_timespec timeout;
+    timeout.tv_sec = usec/TINT_SEC;
+    timeout.tv_nsec = (usec%TINT_SEC)*1000;
+    struct io_uring_getevents_arg arg;
+    memset(&arg,0,sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&timeout;
+    // submits the polls armed since the last call and waits, all at once
+    int r = uring_enter(uring_unsubmitted(),1,
+                        IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                        &arg,sizeof(arg));
+    if (r<0 && errno!=ETIME && errno!=EINTR)
+        print_error("io_uring fails");
+    Time();
+    int sel = 0;
+    unsigned head = *uring.cq_head;
+    while (head!=__atomic_load_n(uring.cq_tail,__ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe cqe = uring.cqes[head & *uring.cq_mask];
+        __atomic_store_n(uring.cq_head,++head,__ATOMIC_RELEASE);
+        SOCKET sock = (SOCKET)(cqe.user_data & 0xffffffff);
+        uint32_t serial = cqe.user_data >> 32;
+        if (!cqe.user_data || sock>=sock_serial.size() ||
+                sock_serial[sock]!=serial)
+            continue; // a removal, or a poll for a closed/changed socket
+        sock_armed[sock] = false;
+        DispatchEvents(sock,serial,cqe.res<0 ? EPOLLERR : cqe.res);
+        sel++;
+        int i = FindSocket(sock);
+        if (i!=-1 && !sock_armed[sock])
+            uring_arm(sock_open[i]);
+    }
+    return sel;
+}
+#endif
+
+
 tint Datagram::Time () {
     //HiResTimeOfDay* tod = HiResTimeOfDay::Instance();
     //tint ret = tod->getTimeUSec();
@@ -186,32 +1039,101 @@ tint Datagram::Time () {
 SOCKET Datagram::Bind (Address address, sckrwecb_t callbacks) {
     struct sockaddr_in addr = address;
     SOCKET fd;
-    int len = sizeof(struct sockaddr_in), sndbuf=1<<20, rcvbuf=1<<20;
+    int len = sizeof(struct sockaddr_in), sndbuf=DGRAM_BUF_INIT, rcvbuf=DGRAM_BUF_INIT;
     #define dbnd_ensure(x) { if (!(x)) { \
         print_error("binding fails"); close_socket(fd); return INVALID_SOCKET; } }
-    dbnd_ensure ( (fd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0 );
+    dbnd_ensure ( (fd = ::socket(AF_INET, SOCK_DGRAM, 0)) >= 0 );
     dbnd_ensure( make_socket_nonblocking(fd) );  // FIXME may remove this
     int enable = true;
+#ifdef __linux__
+    dbnd_ensure ( set_sock_buf(fd,SO_SNDBUF,SO_SNDBUFFORCE,sndbuf) );
+    dbnd_ensure ( set_sock_buf(fd,SO_RCVBUF,SO_RCVBUFFORCE,rcvbuf) );
+    if (fd>=sock_buf.size())
+        sock_buf.resize(fd+1);
+    memset(&sock_buf[fd],0,sizeof(sockbuf_t));
+    sock_buf[fd].rcvbuf = rcvbuf;
+    sock_buf[fd].sndbuf = sndbuf;
+    sock_buf[fd].sized_at = now;
+#else
     dbnd_ensure ( setsockopt(fd, SOL_SOCKET, SO_SNDBUF, 
                              (setsockoptptr_t)&sndbuf, sizeof(int)) == 0 );
     dbnd_ensure ( setsockopt(fd, SOL_SOCKET, SO_RCVBUF, 
                              (setsockoptptr_t)&rcvbuf, sizeof(int)) == 0 );
+#endif
     //setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (setsockoptptr_t)&enable, sizeof(int));
+#ifdef SO_REUSEPORT
+    if (reuse_port)
+        dbnd_ensure ( setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+                                 (setsockoptptr_t)&enable, sizeof(int)) == 0 );
+#endif
     dbnd_ensure ( ::bind(fd, (sockaddr*)&addr, len) == 0 );
+#ifdef SO_RXQ_OVFL
+    // tells the drop count with every datagram once there were drops
+    setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, (setsockoptptr_t)&enable, sizeof(int));
+#endif
+#ifdef SO_TIMESTAMPNS
+    // no timestamps => Recv() falls back to the time of reading
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, (setsockoptptr_t)&enable, sizeof(int));
+#endif
+#ifdef SWIFT_UDP_OFFLOAD
+    if (offload) // old kernels just never coalesce
+        setsockopt(fd, SOL_UDP, UDP_GRO, (setsockoptptr_t)&enable, sizeof(int));
+#endif
     callbacks.sock = fd;
-    Datagram::sock_open[Datagram::sock_count++] = callbacks;
+    AddSocket(callbacks);
     return fd;
 }
 
 void Datagram::Close (SOCKET sock) {
-    for(int i=0; i<Datagram::sock_count; i++)
-        if (Datagram::sock_open[i].sock==sock)
-            Datagram::sock_open[i] = Datagram::sock_open[--Datagram::sock_count];
+    int i = FindSocket(sock);
+    if (i!=-1)
+        RemoveSocket(i);
+#ifdef __linux__
+    if (sock>=0 && sock<sock_buf.size())
+        sock_buf[sock].rcvbuf = 0;
+#endif
     if (!close_socket(sock))
         print_error("on closing a socket");
 }
 
 
+int Datagram::PathPayload (const Address& addr) {
+    int mtu = DGRAM_DEFAULT_MTU;
+#if defined(__linux__) && defined(IP_MTU)
+    // connecting a UDP socket sends nothing, but it picks the route
+    SOCKET fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd>=0) {
+        int route_mtu;
+        socklen_t len = sizeof(int);
+        if ( ::connect(fd,(const sockaddr*)&(addr.addr),
+                       sizeof(struct sockaddr_in))==0 &&
+             getsockopt(fd,IPPROTO_IP,IP_MTU,&route_mtu,&len)==0 )
+            mtu = route_mtu;
+        close_socket(fd);
+    }
+#endif
+    mtu -= 20+8; // IPv4 and UDP headers
+    return mtu<MAXDGRAMSZ ? mtu : MAXDGRAMSZ;
+}
+
+
+uint32_t Datagram::RecvDrops (SOCKET sock) {
+#ifdef __linux__
+    return known_drops(sock);
+#else
+    return 0;
+#endif
+}
+
+tint Datagram::RecvDropTime (SOCKET sock) {
+#ifdef __linux__
+    return sock>=0 && sock<sock_buf.size() ? sock_buf[sock].drop_time : 0;
+#else
+    return 0;
+#endif
+}
+
+
 std::string sock2str (struct sockaddr_in addr) {
     char ipch[32];
 #ifdef _WIN32
@@ -11,17 +11,58 @@
 
 #include <sys/stat.h>
 #include <string.h>
+#include <vector>
 #include "hashtree.h"
 #include "compat.h"
 
 
 namespace swift {
 
-#define MAXDGRAMSZ 2800
+/** The largest datagram built: the largest chunk with its DATA header,
+    the channel id and some room for other messages. */
+#define MAXDGRAMSZ (SWIFT_MAX_CHUNK_SIZE+256)
+/** The path MTU assumed where it can not be learned. */
+#define DGRAM_DEFAULT_MTU 1500
 #ifndef _WIN32
 #define INVALID_SOCKET -1
 #endif
 
+/** On Linux, sockets are registered with epoll once and only the ready
+    ones are dispatched; define SWIFT_NO_EPOLL to fall back to select(). */
+#if defined(__linux__) && !defined(SWIFT_NO_EPOLL)
+#define SWIFT_EPOLL
+#endif
+/** On top of that, socket polls may be batched through io_uring; define
+    SWIFT_NO_URING if the kernel headers lack <linux/io_uring.h>. */
+#if defined(SWIFT_EPOLL) && !defined(SWIFT_NO_URING)
+#define SWIFT_URING
+#endif
+
+/** Max number of datagrams drained from a socket per wakeup. */
+#define DGRAM_RECV_BATCH 32
+/** Max number of datagrams queued by a send batch before it is flushed. */
+#define DGRAM_SEND_BATCH 64
+
+/** On Linux, same-size datagrams to the same peer may be handed to the
+    kernel as one buffer to be split (GSO) and coalesced back (GRO). */
+#ifdef __linux__
+#define SWIFT_UDP_OFFLOAD
+#endif
+/** Max number of datagrams in one offloaded send (UDP_MAX_SEGMENTS). */
+#define DGRAM_GSO_SEGS 64
+/** Max size of one offloaded send, all the segments together. */
+#define DGRAM_GSO_BYTES 65000
+
+/** Socket buffers start at DGRAM_BUF_INIT bytes and are resized within
+    [DGRAM_BUF_MIN,DGRAM_BUF_MAX] to hold DGRAM_BUF_DEPTH worth of the
+    observed traffic; receive overflows double the receive buffer. */
+#define DGRAM_BUF_INIT (1<<20)
+#define DGRAM_BUF_MIN (1<<18)
+#define DGRAM_BUF_MAX (1<<24)
+#define DGRAM_BUF_DEPTH (TINT_SEC/10)
+/** How often the buffer sizes are reconsidered. */
+#define DGRAM_BUF_PERIOD TINT_SEC
+
 
 /** IPv4 address, just a nice wrapping around struct sockaddr_in. */
 struct Address {
@@ -66,6 +107,9 @@ struct Address {
     Address(const struct sockaddr_in& address) : addr(address) {}
     uint32_t ipv4 () const { return ntohl(addr.sin_addr.s_addr); }
     uint16_t port () const { return ntohs(addr.sin_port); }
+    /** The address and port packed into 48 bits; equal for equal
+        addresses, so it both hashes and compares. */
+    uint64_t key () const { return ((uint64_t)ipv4()<<16) | port(); }
     operator sockaddr_in () const {return addr;}
     bool operator == (const Address& b) const {
         return addr.sin_family==b.addr.sin_family &&
@@ -104,42 +148,121 @@ class Datagram {
     Address addr;
     SOCKET sock;
     int offset, length;
-    uint8_t    buf[MAXDGRAMSZ*2];
+    uint8_t*   buf; // MAXDGRAMSZ*2 bytes, from the pool
+    tint       arrival;
+
+    /** Spare datagram buffers. A datagram takes one when constructed and
+        gives it back when destroyed; a send batch swaps buffers with the
+        datagram it takes instead of copying the data. */
+    static std::vector<uint8_t*> buf_pool;
+    static uint8_t* AllocBuffer () {
+        if (buf_pool.empty())
+            return new uint8_t[MAXDGRAMSZ*2];
+        uint8_t* b = buf_pool.back();
+        buf_pool.pop_back();
+        return b;
+    }
+    Datagram (const Datagram&); // buffers are not shared
+    Datagram& operator = (const Datagram&);
+
+    /** Sockets being listened to, with their callbacks. */
+    static std::vector<sckrwecb_t> sock_open;
 
-#define DGRAM_MAX_SOCK_OPEN 128
-    static int sock_count;
-    static sckrwecb_t sock_open[DGRAM_MAX_SOCK_OPEN];
+    static int  FindSocket (SOCKET sock);
+    static void AddSocket (const sckrwecb_t& cb);
+    static void RemoveSocket (int i);
+    static SOCKET WaitSelect (tint usec);
+#ifdef SWIFT_EPOLL
+    static SOCKET WaitEpoll (tint usec);
+    static void DispatchEvents (SOCKET sock, uint32_t serial, uint32_t events);
+#endif
+#ifdef SWIFT_URING
+    static SOCKET WaitUring (tint usec);
+#endif
+#ifdef SWIFT_UDP_OFFLOAD
+    static int RecvSplit (SOCKET socket, Datagram* dgrams, int count);
+#endif
+
+    /** Datagrams queued by the open send batch. */
+    static Datagram send_batch[DGRAM_SEND_BATCH];
+    static int send_batch_size;
+    static bool send_batch_open;
     
 public:
 
+    /** The ways Wait() may wait for socket events, worst to best. */
+    typedef enum {
+        SELECT_BACKEND,
+        EPOLL_BACKEND,
+        URING_BACKEND
+    } backend_t;
+    static const char* BACKEND_NAMES[];
+    static backend_t backend;
+    /** Pick the best backend the kernel supports, but no better than
+        the given one; to be called before any socket is bound, or the
+        first one bound picks the default. Returns the backend picked.
+        io_uring is opt-in: it only polls for readiness, as epoll does,
+        so it is not the default. */
+    static backend_t SelectBackend (backend_t best=EPOLL_BACKEND);
+
     /** bind to the address */
     static SOCKET Bind(Address address, sckrwecb_t callbacks=sckrwecb_t());
 
     /** close the port */
     static void Close(SOCKET sock);
 
-    /** the current time */
+    /** The largest datagram (UDP payload) that makes it to the address
+        unfragmented, as far as the local route knows, but no more than
+        MAXDGRAMSZ. */
+    static int PathPayload (const Address& addr);
+
+    /** Read the clock and refresh now. The library does it once per
+        wait and per send/receive batch, so now is cheap to use but may
+        lag a little; take a fresh reading where precision matters. */
     static tint Time();
 
     /** wait till one of the sockets has some io to do; usec is the timeout */
     static SOCKET Wait (tint usec);
     
+    /** Install, change or (if all callbacks are NULL) remove the
+        callbacks for a socket. */
     static bool Listen3rdPartySocket (sckrwecb_t cb) ;
     
     static void Shutdown ();
     
     static SOCKET default_socket() 
-        { return sock_count ? sock_open[0].sock : INVALID_SOCKET; }
+        { return sock_open.empty() ? INVALID_SOCKET : sock_open[0].sock; }
 
     static tint now, epoch, start;
     static uint64_t dgrams_up, dgrams_down, bytes_up, bytes_down;
+    /** Number of socket wakeups that delivered datagrams; dgrams_down
+        divided by this is the average receive batch. */
+    static uint64_t recv_batches;
+    /** Use segmentation offload (GSO on send, GRO on receive) where the
+        kernel supports it; set before Bind(). Nothing changes on the
+        wire, so peers need not support it. */
+    static bool offload;
+    /** Bind with SO_REUSEPORT, so that several shards share a port. */
+    static bool reuse_port;
+    /** Datagrams the kernel dropped for lack of receive buffer space,
+        over all the sockets. */
+    static uint64_t dgrams_dropped;
+    /** The kernel's count of datagrams dropped at the socket on receive
+        (SO_RXQ_OVFL); it is learned with the next datagram that makes it.
+        Always 0 where the kernel does not tell. */
+    static uint32_t RecvDrops (SOCKET sock);
+    /** When that count last went up; 0 if never. Losses seen around that
+        time may be our own overruns rather than the path's. */
+    static tint RecvDropTime (SOCKET sock);
 
     /** This constructor is normally used to SEND something to the address. */
     Datagram (SOCKET socket, const Address addr_) : addr(addr_), offset(0),
-        length(0), sock(socket) {}
+        length(0), sock(socket), buf(AllocBuffer()), arrival(0) {}
     /** This constructor is normally used to RECEIVE something at the socket. */
-    Datagram (SOCKET socket) : offset(0), length(0), sock(socket) {
+    Datagram (SOCKET socket=INVALID_SOCKET) : offset(0), length(0), sock(socket),
+        buf(AllocBuffer()), arrival(0) {
     }
+    ~Datagram () { buf_pool.push_back(buf); }
 
     /** space remaining */
     int space () const { return MAXDGRAMSZ-length; }
@@ -148,6 +271,11 @@ public:
     std::string str() const { return std::string((char*)buf+offset,size()); }
     const uint8_t* operator * () const { return buf+offset; }
     const Address& address () const { return addr; }
+    SOCKET socket () const { return sock; }
+    /** When a received datagram hit the host: the kernel timestamp where
+        available, otherwise the time it was read. Unlike NOW, that does
+        not include the time it waited for us in the socket buffer. */
+    tint arrival_time () const { return arrival ? arrival : now; }
     /** Append some data at the back */
     int Push (const uint8_t* data, int l) { // scatter-gather one day
         int toc = l<space() ? l : space();
@@ -155,6 +283,16 @@ public:
         length += toc;
         return toc;
     }
+    /** Append file data from the offset, read right into the tail;
+        returns the number of bytes read or -1. */
+    int Push (DataStorage* storage, uint64_t offset, int l) {
+        int toc = l<space() ? l : space();
+        ssize_t r = storage->read((off_t)offset,(char*)buf+length,toc);
+        if (r<0)
+            return -1;
+        length += r;
+        return r;
+    }
     /** Read something from the front of the datagram */
     int Pull (uint8_t** data, int l) {
         int toc = l<size() ? l : size();
@@ -164,8 +302,25 @@ public:
         return toc;
     }
 
+    /** Send the datagram; while a send batch is open, the datagram is
+        queued and actually goes out at FlushSendBatch(). */
     int Send ();
     int Recv ();
+    /** Receive up to count datagrams from the socket at once (a single
+        recvmmsg() call where available); returns the number received.
+        Coalesced (GRO) buffers are split back into datagrams. */
+    static int Recv (SOCKET socket, Datagram* dgrams, int count);
+    /** Whether split datagrams of a coalesced buffer are still waiting
+        for the next Recv() call; the socket will not signal those. */
+    static bool recv_pending ();
+
+    /** Start collecting sent datagrams into a batch. */
+    static void StartSendBatch ();
+    /** Send all the batched datagrams, one sendmmsg() call per socket
+        where available; with offload on, runs of same-size datagrams to
+        the same peer go out as one GSO buffer. Returns the number of
+        datagrams sent. */
+    static int FlushSendBatch ();
 
     void Clear() { offset=length=0; }
 
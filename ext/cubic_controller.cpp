@@ -0,0 +1,86 @@
+/*
+ *  cubic_controller.cpp
+ *  swift
+ *
+ *  Created by agent on 10/18/26.
+ *  Copyright 2026 agent. All rights reserved.
+ *
+ */
+#include <math.h>
+#include "../swift.h"
+
+using namespace swift;
+
+static const float CUBIC_C = 0.4;     // chunks per second cubed
+static const float CUBIC_BETA = 0.7;  // the window kept on a loss
+
+
+/** CUBIC (RFC 8312): after a loss, the window regrows along a cubic curve
+    of the time since: fast while far below the window the loss happened
+    at, slowly around it, then faster and faster probing beyond. As the
+    growth does not depend on the RTT, a long fat path is filled in seconds
+    rather than at a chunk an RTT; on a short thin one, the window grows
+    at least as fast as the AIMD one would (the "TCP-friendly" region). */
+class CubicController : public CongestionController {
+
+    /** The window at the last loss. */
+    float       w_max_;
+    /** An AIMD window grown alongside. */
+    float       w_est_;
+    /** The curve: it is at origin_ k_ seconds after epoch_; epoch_ is 0
+        until the growth begins. */
+    float       origin_;
+    float       k_;
+    tint        epoch_;
+
+public:
+
+    CubicController () : w_max_(0), w_est_(0), origin_(0), k_(0), epoch_(0) {}
+
+    const char* name () const { return "cubic"; }
+
+    void  Start (const Session& path, float cwnd) {
+        epoch_ = 0;
+    }
+
+    float Update (const Session& path, float cwnd, int acked) {
+        if (!acked)
+            return cwnd;
+        if (!epoch_) {
+            epoch_ = NOW;
+            if (cwnd<w_max_) {
+                k_ = pow((w_max_-cwnd)/CUBIC_C,1.0f/3);
+                origin_ = w_max_;
+            } else {
+                k_ = 0;
+                origin_ = cwnd;
+            }
+            w_est_ = cwnd;
+        }
+        // aim at where the curve is an RTT on, by no more than half again
+        float t = (float)(NOW-epoch_+path.rtt()) / TINT_SEC - k_;
+        float target = origin_ + CUBIC_C*t*t*t;
+        if (target>cwnd*1.5)
+            target = cwnd*1.5;
+        if (target>cwnd)
+            cwnd += (target-cwnd) / cwnd * acked;
+        w_est_ += 3*(1-CUBIC_BETA)/(1+CUBIC_BETA) * acked / cwnd;
+        if (w_est_>cwnd)
+            cwnd = w_est_;
+        return cwnd;
+    }
+
+    float OnLoss (const Session& path, float cwnd) {
+        epoch_ = 0;
+        // a loss below the last one's window means a new flow came; the
+        // curve then flattens out short of it to leave the flow some room
+        w_max_ = cwnd<w_max_ ? cwnd*(1+CUBIC_BETA)/2 : cwnd;
+        return cwnd * CUBIC_BETA;
+    }
+
+};
+
+
+CongestionController*   swift::NewCubicController () {
+    return new CubicController();
+}
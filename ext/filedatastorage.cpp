@@ -10,8 +10,6 @@ using namespace swift;
 #define OPENFLAGS         O_RDWR|O_CREAT
 #endif
 
-#define POS2OFFSET(pos)     (pos.base_offset()<<10)
-
 FileDataStorage::FileDataStorage( const char* filename ) : fd_(0) {
     fd_ = open( filename , OPENFLAGS, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
     if( fd_ < 0 ) {
@@ -41,10 +39,6 @@ size_t FileDataStorage::read( off_t pos, char* buf, size_t len ) {
     return pread( fd_, buf, len, pos );
 }
 
-size_t FileDataStorage::read( bin64_t pos, char* buf, size_t len ) {
-    return pread( fd_, buf, len, POS2OFFSET( pos ) );
-}
-
 size_t FileDataStorage::write( const char* buf, size_t len ) {
     return ::write( fd_, buf, len );
 }
@@ -53,10 +47,6 @@ size_t FileDataStorage::write( off_t pos, const char* buf, size_t len ) {
     return pwrite( fd_, buf, len, pos );
 }
 
-size_t FileDataStorage::write( bin64_t pos, const char* buf, size_t len ) {
-    return pwrite( fd_, buf, len, POS2OFFSET( pos ) );
-}
-
 size_t FileDataStorage::size() {
     return file_size( fd_ );
 }
@@ -18,8 +18,6 @@ namespace swift {
         ~FileDataStorage();
         virtual size_t read( off_t pos, char* buf, size_t len );
         virtual size_t write( off_t pos, const char* buf, size_t len );
-        virtual size_t read( bin64_t pos, char* buf, size_t len ); 
-        virtual size_t write( bin64_t pos, const char* buf, size_t len ); 
         virtual size_t read( char* buf, size_t len );
         virtual size_t write( const char* buf, size_t len );
         virtual size_t size();
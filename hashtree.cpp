@@ -84,12 +84,14 @@ std::string    Sha1Hash::hex() const {
 
 /**     H a s h   t r e e       */
 
-HashTree::HashTree (const char* filename, const Sha1Hash& root_hash, const char* hash_filename) :
+HashTree::HashTree (const char* filename, const Sha1Hash& root_hash, const char* hash_filename, uint32_t chunk_size) :
 root_hash_(root_hash), data_recheck_(true),
-peak_count_(0), size_(0), sizek_(0),
-complete_(0), completek_(0), hash_storage_(NULL),
+peak_count_(0), chunk_size_(chunk_size), size_(0), sizec_(0),
+complete_(0), completec_(0), hash_storage_(NULL),
 data_storage_(NULL)
 {
+    if( !chunk_size_ || chunk_size_>SWIFT_MAX_CHUNK_SIZE )
+        return;
     data_storage_ = new FileDataStorage(filename);
     if( !data_storage_->valid() )
         return;
@@ -104,12 +106,17 @@ data_storage_(NULL)
     } // else  LoadComplete()
 }
 
-HashTree::HashTree (const char* filename, const Sha1Hash& root_hash, HashStorage* hash_storage) :
+HashTree::HashTree (const char* filename, const Sha1Hash& root_hash, HashStorage* hash_storage, uint32_t chunk_size) :
 root_hash_(root_hash), data_recheck_(true),
-peak_count_(0), size_(0), sizek_(0),
-complete_(0), completek_(0), hash_storage_(NULL),
+peak_count_(0), chunk_size_(chunk_size), size_(0), sizec_(0),
+complete_(0), completec_(0), hash_storage_(NULL),
 data_storage_(NULL)
 {
+    if( !chunk_size_ || chunk_size_>SWIFT_MAX_CHUNK_SIZE ) {
+        if( hash_storage )
+            delete hash_storage;
+        return;
+    }
     data_storage_ = new FileDataStorage(filename);
     if( !data_storage_->valid() )
         return;
@@ -144,13 +151,14 @@ data_storage_(NULL)
     } // else  LoadComplete()
 }
 
-HashTree::HashTree (DataStorage* data_storage, const Sha1Hash& root_hash, HashStorage* hash_storage) :
+HashTree::HashTree (DataStorage* data_storage, const Sha1Hash& root_hash, HashStorage* hash_storage, uint32_t chunk_size) :
 root_hash_(root_hash), data_recheck_(true),
-peak_count_(0), size_(0), sizek_(0),
-complete_(0), completek_(0), hash_storage_(NULL),
+peak_count_(0), chunk_size_(chunk_size), size_(0), sizec_(0),
+complete_(0), completec_(0), hash_storage_(NULL),
 data_storage_(NULL)
 {
-    if( !data_storage || !data_storage->valid() ) {
+    if( !data_storage || !data_storage->valid() ||
+        !chunk_size_ || chunk_size_>SWIFT_MAX_CHUNK_SIZE ) {
         if( data_storage )
             delete data_storage;
         else
@@ -206,25 +214,25 @@ data_storage_(NULL)
 
 void            HashTree::Submit () {
     size_ = data_storage_->size();
-    sizek_ = (size_ + 1023) >> 10;
-    peak_count_ = bin64_t::peaks(sizek_,peaks_);
-    if( !hash_storage_->setHashCount( sizek_ ) ) {
-        size_ = sizek_ = complete_ = completek_ = 0;
+    sizec_ = (size_ + chunk_size_-1) / chunk_size_;
+    peak_count_ = bin64_t::peaks(sizec_,peaks_);
+    if( !hash_storage_->setHashCount( sizec_ ) ) {
+        size_ = sizec_ = complete_ = completec_ = 0;
         return;
     }
-    for (size_t i=0; i<sizek_; i++) {
-        char kilo[1<<10];
-        size_t rd = data_storage_->read(kilo,1<<10);
-        if (rd<(1<<10) && i!=sizek_-1) {
+    for (size_t i=0; i<sizec_; i++) {
+        char chunk[SWIFT_MAX_CHUNK_SIZE];
+        size_t rd = data_storage_->read(chunk,chunk_size_);
+        if (rd<chunk_size_ && i!=sizec_-1) {
             delete hash_storage_;
             hash_storage_ = NULL;
             return;
         }
         bin64_t pos(0,i);
-        hash_storage_->setHash(pos,Sha1Hash(kilo,rd));
+        hash_storage_->setHash(pos,Sha1Hash(chunk,rd));
         ack_out_.set(pos);
         complete_+=rd;
-        completek_++;
+        completec_++;
     }
     for (int p=0; p<peak_count_; p++) {
         if (!peaks_[p].is_base())
@@ -241,9 +249,9 @@ void            HashTree::Submit () {
  for some optimizations. */
 void            HashTree::RecoverProgress () {
     size_t size = data_storage_->size();
-    size_t sizek = (size + 1023) >> 10;
+    size_t sizec = (size + chunk_size_-1) / chunk_size_;
     bin64_t peaks[64];
-    int peak_count = bin64_t::peaks(sizek,peaks);
+    int peak_count = bin64_t::peaks(sizec,peaks);
     for(int i=0; i<peak_count; i++) {
         Sha1Hash peak_hash;
         peak_hash = hash_storage_->getHash(peaks[i]);
@@ -253,27 +261,27 @@ void            HashTree::RecoverProgress () {
         return; // if no valid peak hashes found
     // at this point, we may use mmapd hashes already
     // so, lets verify hashes and the data we've got
-    char zeros[1<<10];
-    memset(zeros, 0, 1<<10);
-    Sha1Hash kilo_zero(zeros,1<<10);
+    char zeros[SWIFT_MAX_CHUNK_SIZE];
+    memset(zeros, 0, chunk_size_);
+    Sha1Hash chunk_zero(zeros,chunk_size_);
     for(int p=0; p<packet_size(); p++) {
-        char buf[1<<10];
+        char buf[SWIFT_MAX_CHUNK_SIZE];
         bin64_t pos(0,p);
         if(hash_storage_->getHash(pos)==Sha1Hash::ZERO)
             continue;
-        size_t rd = data_storage_->read(buf,1<<10);
-        if (rd!=(1<<10) && p!=packet_size()-1)
+        size_t rd = data_storage_->read(buf,chunk_size_);
+        if (rd!=chunk_size_ && p!=packet_size()-1)
             break;
-        if (rd==(1<<10) && !memcmp(buf, zeros, rd) &&
-                hash_storage_->getHash(pos)!=kilo_zero) // FIXME
+        if (rd==chunk_size_ && !memcmp(buf, zeros, rd) &&
+                hash_storage_->getHash(pos)!=chunk_zero) // FIXME
             continue;
         if ( data_recheck_ && !OfferHash(pos, Sha1Hash(buf,rd)) )
             continue;
         ack_out_.set(pos);
-        completek_++;
+        completec_++;
         complete_+=rd;
-        if (rd!=(1<<10) && p==packet_size()-1)
-            size_ = ((sizek_-1)<<10) + rd;
+        if (rd!=chunk_size_ && p==packet_size()-1)
+            size_ = ((sizec_-1)*chunk_size_) + rd;
     }
 }
 
@@ -294,16 +302,15 @@ bool            HashTree::OfferPeakHash (bin64_t pos, const Sha1Hash& hash) {
     if (mustbe_root!=root_hash_)
         return false;
     for(int i=0; i<peak_count_; i++)
-        sizek_ += peaks_[i].width();
+        sizec_ += peaks_[i].width();
 
-    // bingo, we now know the file size (rounded up to a KByte)
+    // bingo, we now know the file size (rounded up to a chunk)
 
-    size_ = sizek_<<10;
-    completek_ = complete_ = 0;
-    sizek_ = (size_ + 1023) >> 10;
+    size_ = sizec_*chunk_size_;
+    completec_ = complete_ = 0;
 
     size_t cur_size = data_storage_->size();
-    if ( cur_size<=(sizek_-1)<<10  || cur_size>sizek_<<10 ) {
+    if ( cur_size<=(sizec_-1)*chunk_size_  || cur_size>sizec_*chunk_size_ ) {
         if (data_storage_->setSize(size_)) {
             print_error("cannot set file size\n");
             size_=0; // remain in the 0-state
@@ -312,7 +319,7 @@ bool            HashTree::OfferPeakHash (bin64_t pos, const Sha1Hash& hash) {
     }
 
     // tell the storage how big the file really is, for more efficient usage
-    hash_storage_->setHashCount( sizek_ );
+    hash_storage_->setHashCount( sizec_ );
 
     for(int i=0; i<peak_count_; i++)
         hash_storage_->setHash(peaks_[i],peak_hashes_[i]);
@@ -385,7 +392,7 @@ bool            HashTree::OfferData (bin64_t pos, const char* data, size_t lengt
         return false;
     if (!pos.is_base())
         return false;
-    if (length<1024 && pos!=bin64_t(0,sizek_-1))
+    if (length>chunk_size_ || (length<chunk_size_ && pos!=bin64_t(0,sizec_-1)))
         return false;
     if (ack_out_.get(pos)==binmap_t::FILLED)
         return true; // to set data_in_
@@ -401,12 +408,12 @@ bool            HashTree::OfferData (bin64_t pos, const char* data, size_t lengt
 
     //printf("g %lli %s\n",(uint64_t)pos,hash.hex().c_str());
     ack_out_.set(pos,binmap_t::FILLED);
-    if (data_storage_->write(pos,data,length) < 0)
+    if (data_storage_->write((off_t)chunk_offset(pos),data,length) < 0)
         print_error( strerror( errno ) );
     complete_ += length;
-    completek_++;
-    if (pos.base_offset()==sizek_-1) {
-        size_ = ((sizek_-1)<<10) + length;
+    completec_++;
+    if (pos.base_offset()==sizec_-1) {
+        size_ = ((sizec_-1)*chunk_size_) + length;
         if (data_storage_->size()!=size_)
             data_storage_->setSize(size_);
     }
@@ -415,11 +422,11 @@ bool            HashTree::OfferData (bin64_t pos, const char* data, size_t lengt
 
 
 uint64_t      HashTree::seq_complete () {
-    uint64_t seqk = ack_out_.seq_length();
-    if (seqk==sizek_)
+    uint64_t seqc = ack_out_.seq_length();
+    if (seqc==sizec_)
         return size_;
     else
-        return seqk<<10;
+        return seqc*chunk_size_;
 }
 
 HashTree::~HashTree () {
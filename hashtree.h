@@ -18,6 +18,12 @@
 
 namespace swift {
 
+/** Chunk size in bytes, unless the transfer says otherwise; peers that do
+    not advertise a chunk size in the handshake use this one. */
+#define SWIFT_DEFAULT_CHUNK_SIZE 1024
+/** The largest chunk size supported; a chunk goes in one datagram. */
+#define SWIFT_MAX_CHUNK_SIZE 8192
+
 /** This class controls data integrity of some file; hash tree is put to
     an auxilliary file next to it. The hash tree file is mmap'd for
     performance reasons. Actually, I'd like the data file itself to be
@@ -41,12 +47,14 @@ class HashTree {
     HashStorage*    hash_storage_;
     /** Whether to re-hash files. */
     bool            data_recheck_;
+    /** Chunk size in bytes; the root hash is only meaningful with it. */
+    uint32_t        chunk_size_;
     /** Base size, as derived from the hashes. */
     size_t          size_;
-    size_t          sizek_;
+    size_t          sizec_;
     /**    Part of the tree currently checked. */
     size_t          complete_;
-    size_t          completek_;
+    size_t          completec_;
     binmap_t            ack_out_;
 
 protected:
@@ -60,14 +68,17 @@ public:
     
     // @deprecated
     HashTree (const char* file_name, const Sha1Hash& root, 
-              const char* hash_filename);
+              const char* hash_filename,
+              uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE);
     /// After offering the hash_storage to this constructor, it is governed by the HashTree object and will be deleted when deemed appropriate.
     HashTree (const char* file_name, const Sha1Hash& root=Sha1Hash::ZERO,
-              HashStorage* hash_storage=NULL);
+              HashStorage* hash_storage=NULL,
+              uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE);
     /// After offering the hash_storage to this constructor, it is governed by the HashTree object and will be deleted when deemed appropriate.
     /// Ditto for the data_storage.
     HashTree (DataStorage* data_storage, const Sha1Hash& root=Sha1Hash::ZERO,
-              HashStorage* hash_storage=NULL);
+              HashStorage* hash_storage=NULL,
+              uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE);
     
     /** Offer a hash; returns true if it verified; false otherwise.
      Once it cannot be verified (no sibling or parent), the hash
@@ -90,16 +101,22 @@ public:
     bin64_t         peak_for (bin64_t pos) const;
     /** Return a (Merkle) hash for the given bin. */
     const Sha1Hash& hash (bin64_t pos) const {return hash_storage_->getHash(pos);}
-    /** Give the root hash, which is effectively an identifier of this file. */
+    /** Give the root hash, which (together with the chunk size) is
+        effectively an identifier of this file. */
     const Sha1Hash& root_hash () const { return root_hash_; }
+    /** Get the chunk (packet) size, in bytes. */
+    uint32_t        chunk_size () const { return chunk_size_; }
+    /** Offset of the chunk in the file, in bytes. */
+    uint64_t        chunk_offset (bin64_t pos) const
+        { return pos.base_offset()*chunk_size_; }
     /** Get file size, in bytes. */
     uint64_t        size () const { return size_; }
-    /** Get file size in packets (in kilobytes, rounded up). */
-    uint64_t        packet_size () const { return sizek_; }
+    /** Get file size in packets (in chunks, rounded up). */
+    uint64_t        packet_size () const { return sizec_; }
     /** Number of bytes retrieved and checked. */
     uint64_t        complete () const { return complete_; }
     /** Number of packets retrieved and checked. */
-    uint64_t        packets_complete () const { return completek_; }
+    uint64_t        packets_complete () const { return completec_; }
     /** The number of bytes completed sequentially, i.e. from the beginning of
         the file, uninterrupted. */
     uint64_t        seq_complete () ;
@@ -25,6 +25,7 @@ struct http_gw_t {
 
 int http_gw_reqs_open = 0;
 int http_gw_reqs_count = 0;
+uint32_t http_gw_chunk_size = SWIFT_DEFAULT_CHUNK_SIZE;
 
 void HttpGwNewRequestCallback (SOCKET http_conn);
 void HttpGwNewRequestCallback (SOCKET http_conn);
@@ -92,10 +93,11 @@ void HttpGwMayWriteCallback (SOCKET sink) {
 
 void HttpGwSwiftProgressCallback (FileTransfer* transfer, bin64_t bin) {
     dprintf("%s @A pcb: %s\n",tintstr(),bin.str());
+    uint64_t chunk = transfer->file().chunk_size();
     for (int httpc=0; httpc<http_gw_reqs_open; httpc++)
         if (http_requests[httpc].transfer==transfer)
-            if ( (bin.base_offset()<<10) <= http_requests[httpc].offset &&
-                  ((bin.base_offset()+bin.width())<<10) > http_requests[httpc].offset  ) {
+            if ( bin.base_offset()*chunk <= http_requests[httpc].offset &&
+                  (bin.base_offset()+bin.width())*chunk > http_requests[httpc].offset  ) {
                 dprintf("%s @%i progress: %s\n",tintstr(),http_requests[httpc].id,bin.str());
                 sckrwecb_t maywrite_callbacks
                         (http_requests[httpc].sink,NULL,
@@ -180,9 +182,9 @@ void HttpGwNewRequestCallback (SOCKET http_conn){
     dprintf("%s @%i demands %s\n",tintstr(),req->id,hash);
     // initiate transmission
     Sha1Hash root_hash = Sha1Hash(true,hash);
-    FileTransfer* trans = swift::Find(root_hash);
+    FileTransfer* trans = swift::Find(root_hash,http_gw_chunk_size);
     if (!trans)
-        trans = swift::Open(hash,root_hash);
+        trans = swift::Open(hash,root_hash,http_gw_chunk_size);
     req->transfer = trans;
     if (swift::Size(trans)) {
         HttpGwFirstProgressCallback(trans,bin64_t(0,0));
@@ -197,7 +199,7 @@ void HttpGwNewRequestCallback (SOCKET http_conn){
 // be liberal in what you do, be conservative in what you accept
 void HttpGwNewConnectionCallback (SOCKET serv) {
     Address client_address;
-    socklen_t len;
+    socklen_t len = sizeof(struct sockaddr_in);
     SOCKET conn = accept (serv, (sockaddr*) & (client_address.addr), &len);
     if (conn==INVALID_SOCKET) {
         print_error("client conn fails");
@@ -220,7 +222,7 @@ void HttpGwError (SOCKET s) {
 
 
 #include <signal.h>
-SOCKET InstallHTTPGateway (Address bind_to) {
+SOCKET InstallHTTPGateway (Address bind_to, uint32_t chunk_size) {
     SOCKET fd;
     #define gw_ensure(x) { if (!(x)) { \
     print_error("http binding fails"); close_socket(fd); \
@@ -239,6 +241,7 @@ SOCKET InstallHTTPGateway (Address bind_to) {
     gw_ensure ( 0==listen(fd,8) );
     sckrwecb_t install_http(fd,HttpGwNewConnectionCallback,NULL,HttpGwError);
     gw_ensure (swift::Datagram::Listen3rdPartySocket(install_http));
+    http_gw_chunk_size = chunk_size;
     dprintf("%s @0 installed http gateway on %s\n",tintstr(),bind_to.str());
     return fd;
 }
@@ -18,8 +18,12 @@ tint Channel::LEDBAT_TARGET = TINT_MSEC*25;
 float Channel::LEDBAT_GAIN = 1.0/LEDBAT_TARGET;
 tint Channel::LEDBAT_DELAY_BIN = TINT_SEC*30;
 tint Channel::MAX_POSSIBLE_RTT = TINT_SEC*10;
+tint Channel::SEND_BURST = TINT_MSEC;
+tint Channel::MAX_ACK_DELAY = TINT_MSEC*10;
+int Channel::MAX_DELAYED_ACKS = 8;
+std::map<SOCKET,uint32_t> Channel::drops_counted;
 const char* Channel::SEND_CONTROL_MODES[] = {"keepalive", "pingpong",
-    "slowstart", "standard_aimd", "ledbat", "closing"};
+    "slowstart", "congavoid", "closing"};
 
 
 tint    Channel::NextSendTime () {
@@ -28,8 +32,7 @@ tint    Channel::NextSendTime () {
         case KEEP_ALIVE_CONTROL: return KeepAliveNextSendTime();
         case PING_PONG_CONTROL:  return PingPongNextSendTime();
         case SLOW_START_CONTROL: return SlowStartNextSendTime();
-        case AIMD_CONTROL:       return AimdNextSendTime();
-        case LEDBAT_CONTROL:     return LedbatNextSendTime();
+        case CONG_AVOID_CONTROL: return CongAvoidNextSendTime();
         case CLOSE_CONTROL:      return TINT_NEVER;
         default:                 assert(false);
     }
@@ -38,24 +41,44 @@ tint    Channel::NextSendTime () {
 tint    Channel::SwitchSendControl (int control_mode) {
     dprintf("%s #%u sendctrl switch %s->%s\n",tintstr(),id(),
             SEND_CONTROL_MODES[send_control_],SEND_CONTROL_MODES[control_mode]);
+    Session& s = *session_;
+    if (is_sending())
+        s.senders_--;
+    // the window is the session's; as long as some other channel sends
+    // data, it is kept as it is (see ack_timeout() on the RTT deviation)
     switch (control_mode) {
         case KEEP_ALIVE_CONTROL:
-            send_interval_ = rtt_avg_; //max(TINT_SEC/10,rtt_avg_);
-            dev_avg_ = max(TINT_SEC,rtt_avg_);
-            data_out_cap_ = bin64_t::ALL;
-            cwnd_ = 1;
+            send_interval_ = s.rtt_avg_; //max(TINT_SEC/10,rtt_avg_);
+            if (!s.senders_)
+                s.cwnd_ = 1;
             break;
         case PING_PONG_CONTROL:
-            dev_avg_ = max(TINT_SEC,rtt_avg_);
-            data_out_cap_ = bin64_t::ALL;
-            cwnd_ = 1;
+            if (!s.senders_)
+                s.cwnd_ = 1;
             break;
         case SLOW_START_CONTROL:
-            cwnd_ = 1;
+            if (s.senders_) { // the window is in use: take a share as it is
+                if (s.control_!=transfer_->congestion_control())
+                    dprintf("%s #%u sendctrl shares the %s window\n",
+                            tintstr(),id_,s.controller_->name());
+                control_mode = CONG_AVOID_CONTROL;
+                break;
+            }
+            // the first sender brings its transfer's controller
+            s.Control(transfer_->congestion_control());
+            s.slow_start_ = true;
+            if (s.warm_cwnd_>1) { // the path is known from before
+                s.cwnd_ = s.warm_cwnd_;
+                s.warm_cwnd_ = 1;
+                s.warm_ = true;
+                control_mode = CONG_AVOID_CONTROL;
+                dprintf("%s #%u sendctrl warm start %3.2f\n",tintstr(),id_,s.cwnd_);
+            } else {
+                s.cwnd_ = 1;
+                s.warm_ = false;
+            }
             break;
-        case AIMD_CONTROL:
-            break;
-        case LEDBAT_CONTROL:
+        case CONG_AVOID_CONTROL:
             break;
         case CLOSE_CONTROL:
             break;
@@ -63,6 +86,12 @@ tint    Channel::SwitchSendControl (int control_mode) {
             assert(false);
     }
     send_control_ = control_mode;
+    if (send_control_==CONG_AVOID_CONTROL && s.slow_start_) {
+        s.slow_start_ = false; // the session goes on to congestion avoidance
+        s.controller_->Start(s,s.cwnd_);
+    }
+    if (is_sending())
+        s.senders_++;
     return NextSendTime();
 }
 
@@ -71,13 +100,16 @@ tint    Channel::KeepAliveNextSendTime () {
         return SwitchSendControl(CLOSE_CONTROL);
     if (ack_rcvd_recent_)
         return SwitchSendControl(SLOW_START_CONTROL);
-    if (data_in_.time!=TINT_NEVER)
-        return NOW;
+    if (!data_in_.empty())
+        return AckDueTime();
     if (last_send_time_==NOW)
         send_interval_ <<= 1;
     if (send_interval_>MAX_SEND_INTERVAL)
         send_interval_ = MAX_SEND_INTERVAL;
-    return last_send_time_ + send_interval_;
+    // while the peer talks on other transfers (and knows about sessions,
+    // so it holds back its keep-alives as well), the session is alive
+    tint heard = session_->tags_in_ ? session_->last_recv_time_ : 0;
+    return max(last_send_time_,heard) + send_interval_;
 }
 
 tint    Channel::PingPongNextSendTime () { // FIXME INFINITE LOOP
@@ -85,90 +117,149 @@ tint    Channel::PingPongNextSendTime () { // FIXME INFINITE LOOP
         return SwitchSendControl(KEEP_ALIVE_CONTROL);
     if (ack_rcvd_recent_)
         return SwitchSendControl(SLOW_START_CONTROL);
-    if (data_in_.time!=TINT_NEVER)
-        return NOW;
+    if (!data_in_.empty())
+        return AckDueTime();
     if (last_recv_time_>last_send_time_)
         return NOW;
     if (!last_send_time_)
         return NOW;
-    return last_send_time_ + ack_timeout(); // timeout
+    // an unanswered handshake is retried no faster than before sessions:
+    // the peer may be holding back (see "have a channel already"), and
+    // the session's RTT would run through the tries in no time
+    tint tmo = ack_timeout();
+    if (!peer_channel_id_ && tmo<TINT_SEC)
+        tmo = TINT_SEC;
+    return last_send_time_ + tmo; // timeout
+}
+
+tint    Channel::AckDueTime () {
+    if (data_in_.empty())
+        return TINT_NEVER;
+    if (data_in_.size()>=MAX_DELAYED_ACKS)
+        return NOW;
+    return data_in_.front().time + min(MAX_ACK_DELAY,session_->rtt_avg_>>2);
 }
 
 tint    Channel::CwndRateNextSendTime () {
-    if (data_in_.time!=TINT_NEVER)
-        return NOW; // TODO: delayed ACKs
+    tint ack_due = AckDueTime();
     //if (last_recv_time_<NOW-rtt_avg_*4)
     //    return SwitchSendControl(KEEP_ALIVE_CONTROL);
-    send_interval_ = rtt_avg_/cwnd_;
-    if (send_interval_>max(rtt_avg_,TINT_SEC)*4)
+    tint rtt = session_->rtt_avg_;
+    float cwnd = this->cwnd();
+    send_interval_ = rtt/cwnd;
+    if (send_interval_>max(rtt,TINT_SEC)*4)
         return SwitchSendControl(KEEP_ALIVE_CONTROL);
-    if (data_out_.size()<cwnd_) {
+    if (data_out_.size()<cwnd) {
         dprintf("%s #%u sendctrl next in %llius (cwnd %.2f, data_out %i)\n",
-                tintstr(),id_,(long long int)send_interval_,cwnd_,(int)data_out_.size());
-        return last_data_out_time_ + send_interval_;
+                tintstr(),id_,(long long int)send_interval_,cwnd,(int)data_out_.size());
+        return min(ack_due,last_data_out_time_ + send_interval_);
     } else {
         assert(data_out_.front().time!=TINT_NEVER);
-        return data_out_.front().time + ack_timeout();
+        return min(ack_due,data_out_.front().time + ack_timeout());
     }
 }
 
-void    Channel::BackOffOnLosses (float ratio) {
+void    Channel::BackOffOnLosses () {
+    int losses = ack_not_rcvd_recent_;
     ack_rcvd_recent_ = 0;
     ack_not_rcvd_recent_ =  0;
-    if (last_loss_time_<NOW-rtt_avg_) {
-        cwnd_ *= ratio;
-        last_loss_time_ = NOW;
-        dprintf("%s #%u sendctrl backoff %3.2f\n",tintstr(),id_,cwnd_);
+    // if our socket overflowed, some "lost" ACKs may have been dropped
+    // right here, and the path is not to blame for those; a local drop
+    // explains one loss, to whichever channel on the socket sees it first
+    Session& s = *session_;
+    uint32_t drops = Datagram::RecvDrops(socket_);
+    uint32_t& counted = drops_counted[socket_];
+    if (counted>drops) // the socket was reopened
+        counted = drops;
+    uint32_t excused = min((uint32_t)losses,drops-counted);
+    counted += excused;
+    if ((int)excused==losses) {
+        dprintf("%s #%u sendctrl no backoff, %i losses, %u local drops\n",
+                tintstr(),id_,losses,drops);
+        return;
+    }
+    if (s.last_loss_time_<NOW-s.rtt_avg_) { // once an RTT for the session
+        // slow start is cut back by half whatever the controller: it may
+        // have overshot by that much
+        if (send_control_==SLOW_START_CONTROL)
+            s.cwnd_ *= 0.5;
+        else
+            s.cwnd_ = s.controller_->OnLoss(s,s.cwnd_);
+        if (s.cwnd_<1)
+            s.cwnd_ = 1;
+        s.last_loss_time_ = NOW;
+        dprintf("%s #%u sendctrl backoff %3.2f\n",tintstr(),id_,s.cwnd_);
     }
 }
 
 tint    Channel::SlowStartNextSendTime () {
+    if (!session_->slow_start_) // another sender is past it
+        return SwitchSendControl(CONG_AVOID_CONTROL);
     if (ack_not_rcvd_recent_) {
         BackOffOnLosses();
-        return SwitchSendControl(LEDBAT_CONTROL);//AIMD_CONTROL);
+        return SwitchSendControl(CONG_AVOID_CONTROL);
     } 
-    if (rtt_avg_/cwnd_<TINT_SEC/10) 
-        return SwitchSendControl(LEDBAT_CONTROL);//AIMD_CONTROL);
-    cwnd_+=ack_rcvd_recent_;
+    if (session_->rtt_avg_/cwnd()<TINT_SEC/10)
+        return SwitchSendControl(CONG_AVOID_CONTROL);
+    session_->cwnd_+=ack_rcvd_recent_;
     ack_rcvd_recent_=0;
     return CwndRateNextSendTime();
 }
 
-tint    Channel::AimdNextSendTime () {
+tint    Channel::CongAvoidNextSendTime () {
+    Session& s = *session_;
     if (ack_not_rcvd_recent_)
         BackOffOnLosses();
-    if (ack_rcvd_recent_) {
-        if (cwnd_>1)
-            cwnd_ += ack_rcvd_recent_/cwnd_;
-        else
-            cwnd_ *= 2;
-    }
-    ack_rcvd_recent_=0;
+    s.cwnd_ = s.controller_->Update(s,s.cwnd_,ack_rcvd_recent_);
+    ack_rcvd_recent_ = 0;
+    if (s.cwnd_<1)
+        s.cwnd_ = 1;
+    s.stable_cwnd_ = s.cwnd_;
+    s.stable_time_ = NOW;
+    dprintf("%s #%u sendctrl %s => %3.2f\n",
+            tintstr(),id_,s.controller_->name(),s.cwnd_);
     return CwndRateNextSendTime();
 }
 
-tint Channel::LedbatNextSendTime () {
-    tint owd_cur(TINT_NEVER), owd_min(TINT_NEVER);
-    for(int i=0; i<4; i++) {
-        if (owd_min>owd_min_bins_[i])
-            owd_min = owd_min_bins_[i];
-        if (owd_cur>owd_current_[i])
-            owd_cur = owd_current_[i];
+
+/** Keeps the queueing delay it adds at LEDBAT_TARGET: the window grows
+    as long as the delay is below the target, shrinks once it is above. */
+class LedbatController : public CongestionController {
+public:
+    const char* name () const { return "ledbat"; }
+    float Update (const Session& path, float cwnd, int acked) {
+        tint queueing_delay = path.queueing_delay();
+        if (queueing_delay==TINT_NEVER) // a cached window holds till
+            return path.warm() ? cwnd : 1; // there are delay samples
+        tint off_target = Channel::LEDBAT_TARGET - queueing_delay;
+        return cwnd + Channel::LEDBAT_GAIN * off_target / cwnd;
     }
-    if (ack_not_rcvd_recent_)
-        BackOffOnLosses(0.8);
-    ack_rcvd_recent_ = 0;
-    tint queueing_delay = owd_cur - owd_min;
-    tint off_target = LEDBAT_TARGET - queueing_delay;
-    cwnd_ += LEDBAT_GAIN * off_target / cwnd_;
-    if (cwnd_<1)
-        cwnd_ = 1;
-    if (owd_cur==TINT_NEVER || owd_min==TINT_NEVER)
-        cwnd_ = 1;
-    dprintf("%s #%u sendctrl ledbat %lli-%lli => %3.2f\n",
-            tintstr(),id_,(long long int)owd_cur,(long long int)owd_min,cwnd_);
-    return CwndRateNextSendTime();
-}
+    float OnLoss (const Session& path, float cwnd) {
+        return cwnd * 0.8;
+    }
+};
 
 
+/** Additive increase of a chunk an RTT, multiplicative decrease. */
+class AimdController : public CongestionController {
+public:
+    const char* name () const { return "aimd"; }
+    float Update (const Session& path, float cwnd, int acked) {
+        if (!acked)
+            return cwnd;
+        return cwnd>1 ? cwnd + acked/cwnd : cwnd*2;
+    }
+    float OnLoss (const Session& path, float cwnd) {
+        return cwnd * 0.5;
+    }
+};
+
+
+CongestionController*   swift::NewLedbatController () {
+    return new LedbatController();
+}
+
 
+CongestionController*   swift::NewAimdController () {
+    return new AimdController();
+}
@@ -34,8 +34,10 @@ void    Channel::AddPeakHashes (Datagram& dgram) {
 
 void    Channel::AddUncleHashes (Datagram& dgram, bin64_t pos) {
     bin64_t peak = file().peak_for(pos);
-    while (pos!=peak && ((NOW&3)==3 || !data_out_cap_.within(pos.parent())) &&
-            ack_in_.get(pos.parent())==binmap_t::EMPTY  ) {
+    // the peer has the hashes of both children of any node it has (or
+    // is getting) some data under
+    while (pos!=peak && ack_in_.get(pos.parent())==binmap_t::EMPTY &&
+            hash_out_.get(pos.parent())==binmap_t::EMPTY ) {
         bin64_t uncle = pos.sibling();
         dgram.Push8(SWIFT_HASH);
         dgram.Push32((uint32_t)uncle);
@@ -53,7 +55,7 @@ bin64_t           Channel::ImposeHint () {
     ack_in_.twist(twist);
     bin64_t my_pick =
         file().ack_out().find_filtered(ack_in_,bin64_t::ALL,binmap_t::FILLED);
-    while (my_pick.width()>max(1,(int)cwnd_))
+    while (my_pick.width()>max(1,(int)cwnd()))
         my_pick = my_pick.left();
     file().ack_out().twist(0);
     ack_in_.twist(0);
@@ -62,10 +64,11 @@ bin64_t           Channel::ImposeHint () {
 
 
 bin64_t        Channel::DequeueHint () {
-    if (hint_in_.empty() && last_recv_time_>NOW-rtt_avg_-TINT_SEC) {
+    if (hint_in_.empty() && last_recv_time_>NOW-session_->rtt_avg_-TINT_SEC) {
         bin64_t my_pick = ImposeHint(); // FIXME move to the loop
         if (my_pick!=bin64_t::NONE) {
             hint_in_.push_back(my_pick);
+            hint_in_size_ += my_pick.width();
             dprintf("%s #%u *hint %s\n",tintstr(),id_,my_pick.str());
         }
     }
@@ -74,19 +77,27 @@ bin64_t        Channel::DequeueHint () {
         bin64_t hint = hint_in_.front().bin;
         tint time = hint_in_.front().time;
         hint_in_.pop_front();
-        while (!hint.is_base()) { // FIXME optimize; possible attack
-            hint_in_.push_front(tintbin(time,hint.right()));
-            hint = hint.left();
-        }
+        hint_in_size_ -= hint.width();
         //if (time < NOW-TINT_SEC*3/2 )
         //    continue;  bad idea
-        if (ack_in_.get(hint)!=binmap_t::FILLED)
-            send = hint;
+        while (hint.layer()>59) // no file is that big; binmaps can't cover it
+            hint = hint.left();
+        // skip whatever the peer has already got in one lookup
+        bin64_t gap = ack_in_.find(hint,binmap_t::EMPTY);
+        if (gap==bin64_t::NONE)
+            continue;
+        send = gap.left_foot();
+        // the rest goes back as the right halves on the way down
+        while (hint!=send) {
+            if (send.within(hint.left())) {
+                hint_in_.push_front(tintbin(time,hint.right()));
+                hint_in_size_ += hint.right().width();
+                hint = hint.left();
+            } else
+                hint = hint.right();
+        }
     }
-    uint64_t mass = 0;
-    for(int i=0; i<hint_in_.size(); i++)
-        mass += hint_in_[i].bin.width();
-    dprintf("%s #%u dequeued %s [%llu]\n",tintstr(),id_,send.str(),(unsigned long long int)mass);
+    dprintf("%s #%u dequeued %s [%llu]\n",tintstr(),id_,send.str(),(unsigned long long int)hint_in_size_);
     return send;
 }
 
@@ -99,11 +110,17 @@ void    Channel::AddHandshake (Datagram& dgram) {
         dprintf("%s #%u +hash ALL %s\n",
                 tintstr(),id_,file().root_hash().hex().c_str());
     }
+    if (file().chunk_size()!=SWIFT_DEFAULT_CHUNK_SIZE) {
+        dgram.Push8(SWIFT_CHUNK_SIZE);
+        dgram.Push32(file().chunk_size());
+        dprintf("%s #%u +chunk %u\n",tintstr(),id_,file().chunk_size());
+    }
     dgram.Push8(SWIFT_HANDSHAKE);
-    int encoded = EncodeID(id_);
+    int encoded = EncodeID(tagged_id());
     dgram.Push32(encoded);
     dprintf("%s #%u +hs %x\n",tintstr(),id_,encoded);
     have_out_.clear();
+    have_out_offset_ = 0;
     AddHave(dgram);
 }
 
@@ -121,10 +138,16 @@ void    Channel::Send () {
         AddPex(dgram);
         TimeoutDataOut();
         data = AddData(dgram);
+        AddSessionAcks(dgram);
     } else {
         AddHandshake(dgram);
         AddHave(dgram);
         AddAck(dgram);
+        if (tag_!=Session::NO_TAG) { // last, so that old peers get the rest
+            dgram.Push8(SWIFT_TRANSFER_INDEX);
+            dgram.Push16(tag_);
+            dprintf("%s #%u +index %x\n",tintstr(),id_,tag_);
+        }
     }
     dprintf("%s #%u sent %ib %s:%x\n",
             tintstr(),id_,dgram.size(),peer().str(),peer_channel_id_);
@@ -143,15 +166,16 @@ void    Channel::Send () {
 
 void    Channel::AddHint (Datagram& dgram) {
 
-    tint plan_for = max(TINT_SEC,rtt_avg_*4);
+    tint plan_for = max(TINT_SEC,session_->rtt_avg_*4);
 
     tint timed_out = NOW - plan_for*2;
     while ( !hint_out_.empty() && hint_out_.front().time < timed_out ) {
         hint_out_size_ -= hint_out_.front().bin.width();
+        hint_out_map_.set(hint_out_.front().bin,binmap_t::EMPTY);
         hint_out_.pop_front();
     }
 
-    int plan_pck = max ( (tint)1, plan_for / dip_avg_ );
+    int plan_pck = max ( (tint)1, plan_for / max((tint)1,dip_avg_) );
 
     if ( hint_out_size_ < plan_pck ) {
 
@@ -164,6 +188,7 @@ void    Channel::AddHint (Datagram& dgram) {
             dprintf("%s #%u +hint %s [%llu]\n",tintstr(),id_,hint.str(),(unsigned long long int)hint_out_size_);
             hint_out_.push_back(hint);
             hint_out_size_ += hint.width();
+            hint_out_map_.set(hint);
         } else
             dprintf("%s #%u Xhint\n",tintstr(),id_);
 
@@ -178,7 +203,8 @@ bin64_t        Channel::AddData (Datagram& dgram) {
 
     bin64_t tosend = bin64_t::NONE;
     tint luft = send_interval_>>4; // may wake up a bit earlier
-    if (data_out_.size()<cwnd_ &&
+    float cwnd = this->cwnd();
+    if (data_out_.size()<cwnd &&
             last_data_out_time_+send_interval_<=NOW+luft) {
         tosend = DequeueHint();
         if (tosend==bin64_t::NONE) {
@@ -188,55 +214,137 @@ bin64_t        Channel::AddData (Datagram& dgram) {
         }
     } else
         dprintf("%s #%u sendctrl wait cwnd %f data_out %i next %s\n",
-                tintstr(),id_,cwnd_,(int)data_out_.size(),tintstr(last_data_out_time_+NOW-send_interval_));
+                tintstr(),id_,cwnd,(int)data_out_.size(),tintstr(last_data_out_time_+NOW-send_interval_));
 
     if (tosend==bin64_t::NONE)// && (last_data_out_time_>NOW-TINT_SEC || data_out_.empty()))
         return bin64_t::NONE; // once in a while, empty data is sent just to check rtt FIXED
 
-    if (ack_in_.is_empty() && file().size())
-        AddPeakHashes(dgram);
-    AddUncleHashes(dgram,tosend);
-    if (!ack_in_.is_empty()) // TODO: cwnd_>1
-        data_out_cap_ = tosend;
+    if (!PackData(dgram,tosend,true))
+        return bin64_t::NONE;
 
-    if (dgram.size()>254) {
-        dgram.Send(); // kind of fragmentation
-        dgram.Push32(peer_channel_id_);
+    // more chunks go into the same datagram if the window is open and
+    // they are due shortly anyway; only full chunks may be followed
+    bin64_t next;
+    while ( data_out_.size()<cwnd &&
+            last_data_out_time_+send_interval_<=NOW+SEND_BURST &&
+            dgram.size()+1+4+file().chunk_size()<=session_->payload() &&
+            data_out_.back().bin.base_offset()+1<file().packet_size() &&
+            (next=DequeueHint())!=bin64_t::NONE ) {
+        tint slot = last_data_out_time_ + send_interval_;
+        if (!PackData(dgram,next,false)) {
+            hint_in_.push_front(tintbin(next)); // next time
+            hint_in_size_++;
+            break;
+        }
+        if (slot>last_data_out_time_) // keep the pace on average
+            last_data_out_time_ = slot;
+    }
+
+    return tosend;
+}
+
+
+bool    Channel::PackData (Datagram& dgram, bin64_t pos, bool may_flush) {
+
+    Datagram hashes(socket_,peer());
+    if (ack_in_.is_empty() && file().size())
+        AddPeakHashes(hashes);
+    AddUncleHashes(hashes,pos);
+
+    uint64_t offset = file().chunk_offset(pos);
+    int chunk = file().size()-offset<file().chunk_size() ?
+                file().size()-offset : file().chunk_size();
+    if (dgram.size()+hashes.size()+1+4+chunk>session_->payload()) {
+        if (!may_flush)
+            return false;
+        if (dgram.size()>4) { // no room: let the rest go first
+            dgram.Send();
+            dgram.Push32(peer_channel_id_);
+        }
+        if (dgram.size()+hashes.size()+1+4+chunk>session_->payload()) {
+            // too many hashes even for a datagram of its own
+            dgram.Push(*hashes,hashes.size());
+            dgram.Send();
+            dgram.Push32(peer_channel_id_);
+            hashes.Clear();
+        }
     }
+    dgram.Push(*hashes,hashes.size());
 
     dgram.Push8(SWIFT_DATA);
-    dgram.Push32(tosend.to32());
+    dgram.Push32(pos.to32());
 
-    uint8_t buf[1024];
-    size_t r = file().data_storage()->read( tosend, (char*)buf, 1024 );
+    assert(dgram.space()>=chunk);
+    int r = dgram.Push( file().data_storage(), offset, chunk );
     // TODO: corrupted data, retries, caching
     if (r<0) {
         print_error("error on reading");
-        return bin64_t::NONE;
+        return false;
     }
-    assert(dgram.space()>=r+4+1);
-    dgram.Push(buf,r);
 
-    last_data_out_time_ = NOW;
-    data_out_.push_back(tosend);
-    dprintf("%s #%u +data %s\n",tintstr(),id_,tosend.str());
+    hash_out_.set(pos);
+    last_data_out_time_ = Datagram::Time(); // an RTT sample to be
+    uint64_t seq = data_out_seq_ + data_out_.size();
+    std::map<bin64_t,uint64_t>::iterator sent = data_out_idx_.find(pos);
+    if (sent!=data_out_idx_.end()) { // sent again while in flight
+        data_out_[sent->second-data_out_seq_] = tintbin();
+        sent->second = seq;
+    } else
+        data_out_idx_[pos] = seq;
+    data_out_.push_back(tintbin(last_data_out_time_,pos));
+    dprintf("%s #%u +data %s\n",tintstr(),id_,pos.str());
 
-    return tosend;
+    return true;
 }
 
 
 void    Channel::AddAck (Datagram& dgram) {
-    if (data_in_==tintbin())
+    if (data_in_.empty())
         return;
-    dgram.Push8(SWIFT_ACK);
-    dgram.Push32(data_in_.bin.to32()); // FIXME not cover
-    dgram.Push64(data_in_.time); // FIXME 32
-    have_out_.set(data_in_.bin);
-    dprintf("%s #%u +ack %s %s\n",
-        tintstr(),id_,data_in_.bin.str(),tintstr(data_in_.time));
-    if (data_in_.bin.layer()>2)
-        data_in_dbl_ = data_in_.bin;
-    data_in_ = tintbin();
+    // one ACK per covering bin, stamped with the latest arrival in it;
+    // the covers are gathered at the front of data_in_, in place
+    int covers = 0;
+    for(int i=0; i<data_in_.size(); i++) {
+        if (data_in_[i].bin==bin64_t::NONE)
+            continue;
+        tintbin ack(data_in_[i].time,file().ack_out().cover(data_in_[i].bin));
+        int j = 0;
+        while (j<covers) {
+            if (data_in_[j].bin.within(ack.bin)) { // covers are nested or apart
+                ack.time = max(ack.time,data_in_[j].time);
+                data_in_[j] = data_in_[--covers];
+            } else if (ack.bin.within(data_in_[j].bin)) {
+                data_in_[j].time = max(ack.time,data_in_[j].time);
+                ack.bin = bin64_t::NONE;
+                break;
+            } else
+                j++;
+        }
+        if (ack.bin!=bin64_t::NONE)
+            data_in_[covers++] = ack;
+    }
+    int left = 0;
+    for(int i=0; i<covers; i++) {
+        tintbin ack = data_in_[i];
+        if (dgram.size()+1+4+8>session_->payload()) { // the rest goes next time
+            data_in_[left++] = ack;
+            continue;
+        }
+        dgram.Push8(SWIFT_ACK);
+        dgram.Push32(ack.bin.to32());
+        dgram.Push64(ack.time); // FIXME 32
+        have_out_.set(ack.bin);
+        dprintf("%s #%u +ack %s %s\n",
+            tintstr(),id_,ack.bin.str(),tintstr(ack.time));
+        if (ack.bin.layer()>2)
+            data_in_dbl_ = ack.bin;
+    }
+    while (data_in_.size()>left)
+        data_in_.pop_back();
+    if (left)
+        session_->LinkAcks(this);
+    else
+        session_->UnlinkAcks(this);
 }
 
 
@@ -246,11 +354,21 @@ void    Channel::AddHave (Datagram& dgram) {
         dgram.Push32(data_in_dbl_.to32());
         data_in_dbl_=bin64_t::NONE;
     }
-    for(int count=0; count<4; count++) {
-        bin64_t ack = file().ack_out().find_filtered // FIXME: do rotating queue
-            (have_out_, bin64_t::ALL, binmap_t::FILLED);
+    for(int count=0; count<4; ) {
+        bin64_t ack = transfer().RevealAck(have_out_offset_);
         if (ack==bin64_t::NONE)
             break;
+        if (ack==bin64_t::ALL) { // fell behind the queue, look it up
+            ack = file().ack_out().find_filtered
+                (have_out_, bin64_t::ALL, binmap_t::FILLED);
+            if (ack==bin64_t::NONE) { // caught up, follow the queue
+                have_out_offset_ = transfer().ack_log_start_ +
+                                   transfer().ack_log_.size();
+                continue;
+            }
+        } else if (have_out_.get(ack)==binmap_t::FILLED)
+            continue; // ACKed or announced already
+        count++;
         ack = file().ack_out().cover(ack);
         have_out_.set(ack);
         dgram.Push8(SWIFT_HAVE);
@@ -264,31 +382,41 @@ void    Channel::Recv (Datagram& dgram) {
     dprintf("%s #%u recvd %ib\n",tintstr(),id_,dgram.size()+4);
     Channel::totalBytesRead_ += dgram.size();
     dgrams_rcvd_++;
-    if (last_send_time_ && rtt_avg_==TINT_SEC && dev_avg_==0) {
-        rtt_avg_ = NOW - last_send_time_;
-        dev_avg_ = rtt_avg_;
-        dip_avg_ = rtt_avg_;
-        dprintf("%s #%u sendctrl rtt init %lli\n",tintstr(),id_,(long long int)rtt_avg_);
+    Session& s = *session_;
+    if (last_send_time_ && s.rtt_avg_==TINT_SEC && s.dev_avg_==0) {
+        s.rtt_avg_ = NOW - last_send_time_;
+        s.dev_avg_ = s.rtt_avg_;
+        dip_avg_ = s.rtt_avg_;
+        dprintf("%s #%u sendctrl rtt init %lli\n",tintstr(),id_,(long long int)s.rtt_avg_);
     }
+    data_out_acked_ = -1;
     bin64_t data = dgram.size() ? bin64_t::NONE : bin64_t::ALL;
-    while (dgram.size()) {
+    Channel* next = this; // the channel the messages are for
+    while (dgram.size() && next==this) {
         uint8_t type = dgram.Pull8();
         switch (type) {
             case SWIFT_HANDSHAKE: OnHandshake(dgram); break;
+            case SWIFT_CHUNK_SIZE: OnChunkSize(dgram); break;
             case SWIFT_DATA:      data=OnData(dgram); break;
             case SWIFT_HAVE:      OnHave(dgram); break;
             case SWIFT_ACK:       OnAck(dgram); break;
             case SWIFT_HASH:      OnHash(dgram); break;
             case SWIFT_HINT:      OnHint(dgram); break;
             case SWIFT_PEX_ADD:   OnPex(dgram); break;
+            case SWIFT_TRANSFER:  next=OnTransfer(dgram); break;
+            case SWIFT_TRANSFER_INDEX: OnTransferIndex(dgram); break;
             default:
                 eprintf("%s #%u ?msg id unknown %i\n",tintstr(),id_,(int)type);
                 return;
         }
     }
+    CleanDataOut();
     last_recv_time_ = NOW;
+    s.last_recv_time_ = NOW;
     sent_since_recv_ = 0;
-    Reschedule();
+    Reschedule(); // may close this one
+    if (next && next!=this)
+        next->Recv(dgram);
 }
 
 
@@ -301,13 +429,16 @@ void    Channel::OnHash (Datagram& dgram) {
 
 
 void    Channel::CleanHintOut (bin64_t pos) {
-    int hi = 0;
+    if (hint_out_map_.get(pos)!=binmap_t::FILLED)
+        return; // something not hinted or hinted in far past
+    int hi = 0; // the hints skipped are dropped, so the scan is paid for
     while (hi<hint_out_.size() && !pos.within(hint_out_[hi].bin))
         hi++;
     if (hi==hint_out_.size())
-        return; // something not hinted or hinted in far past
+        return;
     while (hi--) { // removing likely snubbed hints
         hint_out_size_ -= hint_out_.front().bin.width();
+        hint_out_map_.set(hint_out_.front().bin,binmap_t::EMPTY);
         hint_out_.pop_front();
     }
     while (hint_out_.front().bin!=pos) {
@@ -318,28 +449,34 @@ void    Channel::CleanHintOut (bin64_t pos) {
     }
     hint_out_.pop_front();
     hint_out_size_--;
+    hint_out_map_.set(pos,binmap_t::EMPTY);
 }
 
 
 bin64_t Channel::OnData (Datagram& dgram) {  // TODO: HAVE NONE for corrupted data
     bin64_t pos = dgram.Pull32();
     uint8_t *data;
-    int length = dgram.Pull(&data,1024);
+    int length = dgram.Pull(&data,file().chunk_size());
     bool ok = (pos==bin64_t::NONE) || 
         (!file().ack_out().get(pos) && file().OfferData(pos, (char*)data, length) );
     dprintf("%s #%u %cdata %s\n",tintstr(),id_,ok?'-':'!',pos.str());
-    data_in_ = tintbin(NOW,bin64_t::NONE);
+    // duplicate or broken data is not acked, but the peer still gets
+    // an answer (HAVEs, hints) soon
+    data_in_.push_back(tintbin(dgram.arrival_time(),ok?pos:bin64_t(bin64_t::NONE)));
+    session_->LinkAcks(this);
     if (!ok)
         return bin64_t::NONE;
+    if (pos!=bin64_t::NONE)
+        transfer().OnDataIn(pos);
     bin64_t cover = transfer().ack_out().cover(pos);
     transfer().callCallbacks(cover);
-    data_in_.bin = pos;
     if (pos!=bin64_t::NONE) {
         if (last_data_in_time_) {
-            tint dip = NOW - last_data_in_time_;
+            tint dip = dgram.arrival_time() - last_data_in_time_;
             dip_avg_ = ( dip_avg_*3 + dip ) >> 2;
+            session_->dip_avg_ = dip_avg_;
         }
-        last_data_in_time_ = NOW;
+        last_data_in_time_ = dgram.arrival_time();
     }
     CleanHintOut(pos);
     return pos;
@@ -357,74 +494,113 @@ void    Channel::OnAck (Datagram& dgram) {
         return;
     }
     ack_in_.set(ackd_pos);
-    int di = 0, ri = 0;
-    // find an entry for the send (data out) event
-    while (  di<data_out_.size() && ( data_out_[di]==tintbin() ||
-           !data_out_[di].bin.within(ackd_pos) )  )
-        di++;
-    // FUTURE: delayed acks
-    // rule out retransmits
-    while (  ri<data_out_tmo_.size() && !data_out_tmo_[ri].bin.within(ackd_pos) )
-        ri++;
-    dprintf("%s #%u %cack %s %lli\n",tintstr(),id_,
-            di==data_out_.size()?'?':'-',ackd_pos.str(),(long long int)peer_time);
-    if (di!=data_out_.size() && ri==data_out_tmo_.size()) { // not a retransmit
-            // round trip time calculations
-        tint rtt = NOW-data_out_[di].time;
-        rtt_avg_ = (rtt_avg_*7 + rtt) >> 3;
-        dev_avg_ = ( dev_avg_*3 + ::abs(rtt-rtt_avg_) ) >> 2;
-        assert(data_out_[di].time!=TINT_NEVER);
-            // one-way delay calculations
-        tint owd = peer_time - data_out_[di].time;
-        owd_cur_bin_ = 0;//(owd_cur_bin_+1) & 3;
-        owd_current_[owd_cur_bin_] = owd;
-        if ( owd_min_bin_start_+TINT_SEC*30 < NOW ) {
-            owd_min_bin_start_ = NOW;
-            owd_min_bin_ = (owd_min_bin_+1) & 3;
-            owd_min_bins_[owd_min_bin_] = TINT_NEVER;
-        }
-        if (owd_min_bins_[owd_min_bin_]>owd)
-            owd_min_bins_[owd_min_bin_] = owd;
-        dprintf("%s #%u sendctrl rtt %lli dev %lli based on %s\n",
-                tintstr(),id_,(long long int)rtt_avg_,(long long int)dev_avg_,data_out_[di].bin.str());
-        ack_rcvd_recent_++;
-        // early loss detection by packet reordering
-        for (int re=0; re<di-MAX_REORDERING; re++) {
-            if (data_out_[re]==tintbin())
-                continue;
-            ack_not_rcvd_recent_++;
-            data_out_tmo_.push_back(data_out_[re].bin);
-            dprintf("%s #%u Rdata %s\n",tintstr(),id_,data_out_.front().bin.str());
-            data_out_cap_ = bin64_t::ALL;
-            data_out_[re] = tintbin();
+    // find the entries for the send (data out) events; an ACK may cover
+    // several, its timestamp being that of the latest one to arrive,
+    // which is taken to be the latest one sent. A cover may also span
+    // chunks the peer got elsewhere and we sent after the ACK left.
+    int di = -1, acked = 0;
+    tintbin sample;
+    std::map<bin64_t,uint64_t>::iterator it =
+        data_out_idx_.lower_bound(ackd_pos.left_foot());
+    while (it!=data_out_idx_.end() && bin64_t(it->first).within(ackd_pos)) {
+        int i = it->second - data_out_seq_;
+        // rule out retransmits and the ones sent too late
+        if (data_out_tmo_idx_.find(it->first)==data_out_tmo_idx_.end() &&
+                data_out_[i].time<=dgram.arrival_time()) {
+            if (i>di) {
+                di = i;
+                sample = data_out_[i];
+            }
+            acked++;
         }
+        data_out_[i] = tintbin();
+        data_out_idx_.erase(it++);
+    }
+    dprintf("%s #%u %cack %s %lli\n",tintstr(),id_,
+            di<0?'?':'-',ackd_pos.str(),(long long int)peer_time);
+    if (di<0) // nothing, or retransmits only
+        return;
+        // round trip time calculations
+    Session& s = *session_; // the samples are the path's
+    tint rtt = dgram.arrival_time()-sample.time;
+    s.rtt_avg_ = (s.rtt_avg_*7 + rtt) >> 3;
+    s.dev_avg_ = ( s.dev_avg_*3 + ::abs(rtt-s.rtt_avg_) ) >> 2;
+    assert(sample.time!=TINT_NEVER);
+        // one-way delay calculations
+    tint owd = peer_time - sample.time;
+    s.owd_cur_bin_ = 0;//(owd_cur_bin_+1) & 3;
+    s.owd_current_[s.owd_cur_bin_] = owd;
+    if ( s.owd_min_bin_start_+TINT_SEC*30 < NOW ) {
+        s.owd_min_bin_start_ = NOW;
+        s.owd_min_bin_ = (s.owd_min_bin_+1) & 3;
+        s.owd_min_bins_[s.owd_min_bin_] = TINT_NEVER;
     }
-    if (di!=data_out_.size())
-        data_out_[di]=tintbin();
+    if (s.owd_min_bins_[s.owd_min_bin_]>owd)
+        s.owd_min_bins_[s.owd_min_bin_] = owd;
+    dprintf("%s #%u sendctrl rtt %lli dev %lli based on %s\n",
+            tintstr(),id_,(long long int)s.rtt_avg_,(long long int)s.dev_avg_,sample.bin.str());
+    ack_rcvd_recent_ += acked;
+    if (di>data_out_acked_)
+        data_out_acked_ = di;
+}
+
+
+void    Channel::CleanDataOut () {
+    // early loss detection by packet reordering; the ACKs for a datagram
+    // are all in by now, so one acking a late chunk does not make the
+    // chunks acked by the next one look lost
+    for (int re=0; re<data_out_acked_-MAX_REORDERING; re++)
+        if (data_out_[re]!=tintbin()) {
+            dprintf("%s #%u Rdata %s\n",tintstr(),id_,data_out_[re].bin.str());
+            LoseDataOut(re);
+        }
+    data_out_acked_ = -1;
     // clear zeroed items
     while (!data_out_.empty() && ( data_out_.front()==tintbin() ||
             ack_in_.is_filled(data_out_.front().bin) ) )
-        data_out_.pop_front();
+        PopDataOut();
     assert(data_out_.empty() || data_out_.front().time!=TINT_NEVER);
 }
 
 
+void    Channel::PopDataOut () {
+    if (data_out_.front()!=tintbin())
+        data_out_idx_.erase(data_out_.front().bin);
+    data_out_.pop_front();
+    data_out_seq_++;
+}
+
+
+void    Channel::LoseDataOut (int i) {
+    bin64_t pos = data_out_[i].bin;
+    ack_not_rcvd_recent_++;
+    data_out_tmo_.push_back(pos);
+    data_out_tmo_idx_[pos] = NOW;
+    hash_out_.set(pos,binmap_t::EMPTY);
+    data_out_idx_.erase(pos);
+    data_out_[i] = tintbin();
+}
+
+
 void Channel::TimeoutDataOut ( ) {
     // losses: timeouted packets
     tint timeout = NOW - ack_timeout();
     while (!data_out_.empty() && 
         ( data_out_.front().time<timeout || data_out_.front()==tintbin() ) ) {
         if (data_out_.front()!=tintbin() && ack_in_.is_empty(data_out_.front().bin)) {
-            ack_not_rcvd_recent_++;
-            data_out_cap_ = bin64_t::ALL;
-            data_out_tmo_.push_back(data_out_.front().bin);
             dprintf("%s #%u Tdata %s\n",tintstr(),id_,data_out_.front().bin.str());
+            LoseDataOut(0);
         }
-        data_out_.pop_front();
+        PopDataOut();
     }
     // clear retransmit queue of older items
-    while (!data_out_tmo_.empty() && data_out_tmo_.front().time<NOW-MAX_POSSIBLE_RTT)
+    while (!data_out_tmo_.empty() && data_out_tmo_.front().time<NOW-MAX_POSSIBLE_RTT) {
+        std::map<bin64_t,tint>::iterator tmo =
+            data_out_tmo_idx_.find(data_out_tmo_.front().bin);
+        if (tmo!=data_out_tmo_idx_.end() && tmo->second==data_out_tmo_.front().time)
+            data_out_tmo_idx_.erase(tmo);
         data_out_tmo_.pop_front();
+    }
 }
 
 
@@ -441,6 +617,7 @@ void    Channel::OnHint (Datagram& dgram) {
     bin64_t hint = dgram.Pull32();
     // FIXME: wake up here
     hint_in_.push_back(hint);
+    hint_in_size_ += hint.width();
     dprintf("%s #%u -hint %s\n",tintstr(),id_,hint.str());
 }
 
@@ -450,8 +627,8 @@ void Channel::OnHandshake (Datagram& dgram) {
     dprintf("%s #%u -hs %x\n",tintstr(),id_,peer_channel_id_);
     // self-connection check
     if (!SELF_CONN_OK) {
-        uint32_t try_id = DecodeID(peer_channel_id_);
-        if (channel(try_id) && !channel(try_id)->peer_channel_id_) {
+        Channel* self = tagged_channel(DecodeID(peer_channel_id_));
+        if (self && !self->peer_channel_id_) {
             peer_channel_id_ = 0;
             Close();
             return; // this is a self-connection
@@ -461,6 +638,17 @@ void Channel::OnHandshake (Datagram& dgram) {
 }
 
 
+void Channel::OnChunkSize (Datagram& dgram) {
+    uint32_t chunk_size = dgram.Pull32();
+    dprintf("%s #%u -chunk %u\n",tintstr(),id_,chunk_size);
+    if (chunk_size!=file().chunk_size()) { // a different file, really
+        eprintf("%s #%u chunk size mismatch %u!=%u\n",
+                tintstr(),id_,chunk_size,file().chunk_size());
+        Close();
+    }
+}
+
+
 void Channel::OnPex (Datagram& dgram) {
     uint32_t ipv4 = dgram.Pull32();
     uint16_t port = dgram.Pull16();
@@ -470,11 +658,54 @@ void Channel::OnPex (Datagram& dgram) {
 }
 
 
+Channel*    Channel::OnTransfer (Datagram& dgram) {
+    uint16_t tag = dgram.Pull16();
+    Channel* c = session_->tagged(tag);
+    if (!c)
+        eprintf("%s #%u ?transfer %x unknown\n",tintstr(),id_,tag);
+    else
+        dprintf("%s #%u -transfer %x #%u\n",tintstr(),id_,tag,c->id_);
+    return c;
+}
+
+
+void    Channel::OnTransferIndex (Datagram& dgram) {
+    uint16_t tag = dgram.Pull16();
+    if (session_->tagged(tag)!=this && peer_tag_==Session::NO_TAG)
+        session_->Bind(tag,this);
+    dprintf("%s #%u -index %x\n",tintstr(),id_,tag);
+}
+
+
+void    Channel::AddSessionAcks (Datagram& dgram) {
+    if (!session_->tags_in_)
+        return; // the peer would not get it
+    // room for the tag, a few HAVEs and an ACK at least
+    const int room = 1+2 + 5*(1+4) + 1+4+8;
+    Channel* c = session_->acks_head_;
+    while (c && dgram.size()+room<=session_->payload()) {
+        Channel* next = c->ack_next_;
+        bool acks = false; // anything to ack, so the tag is not wasted
+        for(int i=0; i<c->data_in_.size() && !acks; i++)
+            acks = c->data_in_[i].bin!=bin64_t::NONE;
+        if (acks && c!=this && c->tag_!=Session::NO_TAG && c->is_established()) {
+            dgram.Push8(SWIFT_TRANSFER);
+            dgram.Push16(c->tag_);
+            dprintf("%s #%u +transfer %x #%u\n",tintstr(),id_,c->tag_,c->id_);
+            c->AddHave(dgram);
+            c->AddAck(dgram);
+            c->Reschedule(); // no ACK due any more
+        }
+        c = next;
+    }
+}
+
+
 void    Channel::AddPex (Datagram& dgram) {
-    int chid = transfer().RevealChannel(pex_out_);
-    if (chid==-1 || chid==id_)
+    Channel* c = transfer().RevealChannel(this);
+    if (!c)
         return;
-    Address a = channels[chid]->peer();
+    Address a = c->peer();
     dgram.Push8(SWIFT_PEX_ADD);
     dgram.Push32(a.ipv4());
     dgram.Push16(a.port());
@@ -483,8 +714,18 @@ void    Channel::AddPex (Datagram& dgram) {
 
 
 void    Channel::RecvDatagram (SOCKET socket) {
-    Datagram data(socket);
-    data.Recv();
+    static Datagram batch[DGRAM_RECV_BATCH]; // reused receive buffers
+    do { // the rest of a split GRO buffer won't wake us up again
+        int count = Datagram::Recv(socket,batch,DGRAM_RECV_BATCH);
+        dprintf("%s #0 drained %i dgrams\n",tintstr(),count);
+        for(int i=0; i<count; i++)
+            DispatchDatagram(batch[i]); // ACKs wait for the batch to end
+    } while (Datagram::recv_pending());
+}
+
+
+void    Channel::DispatchDatagram (Datagram& data) {
+    SOCKET socket = data.socket();
     const Address& addr = data.address();
 #define return_log(...) { fprintf(stderr,__VA_ARGS__); return; }
     if (data.size()<4)
@@ -504,22 +745,27 @@ void    Channel::RecvDatagram (SOCKET socket) {
         if (pos!=bin64_t::ALL)
             return_log ("%s #0 that is not the root hash %s\n",tintstr(),addr.str());
         hash = data.PullHash();
-        FileTransfer* ft = FileTransfer::Find(hash);
+        uint32_t chunk_size = SWIFT_DEFAULT_CHUNK_SIZE;
+        if (data.size()>=1+4 && (*data)[0]==SWIFT_CHUNK_SIZE) {
+            data.Pull8();
+            chunk_size = data.Pull32();
+        }
+        FileTransfer* ft = FileTransfer::Find(hash,chunk_size);
         if (!ft)
-            return_log ("%s #0 hash %s unknown, no such file %s\n",tintstr(),hash.hex().c_str(),addr.str());
+            return_log ("%s #0 hash %s chunk size %u unknown, no such file %s\n",
+                        tintstr(),hash.hex().c_str(),chunk_size,addr.str());
         dprintf("%s #0 -hash ALL %s\n",tintstr(),hash.hex().c_str());
-        for(binqueue::iterator i=ft->hs_in_.begin(); i!=ft->hs_in_.end(); i++)
-            if (channels[*i] && channels[*i]->peer_==data.address() &&
-                channels[*i]->last_recv_time_>NOW-TINT_SEC*2)
+        for(Channel* c=PeerChannel(addr,ft); c; c=PeerChannel(addr,ft,c))
+            if (c->last_recv_time_>NOW-TINT_SEC*2)
                 return_log("%s #0 have a channel already to %s\n",tintstr(),addr.str());
         channel = new Channel(ft, socket, data.address());
     } else {
         mych = DecodeID(mych);
-        if (mych>=channels.size())
+        if ((mych&((1<<ID_BITS)-1))>=channels.size())
             return_log("%s invalid channel #%u, %s\n",tintstr(),mych,addr.str());
-        channel = channels[mych];
+        channel = tagged_channel(mych);
         if (!channel)
-            return_log ("%s #%u is already closed\n",tintstr(),mych,addr.str());
+            return_log ("%s #%u is already closed\n",tintstr(),mych&((1<<ID_BITS)-1));
         if (channel->peer() != addr)
             return_log ("%s #%u invalid peer address %s!=%s\n",
                         tintstr(),mych,channel->peer().str(),addr.str());
@@ -530,36 +776,56 @@ void    Channel::RecvDatagram (SOCKET socket) {
 }
 
 
+Channel*    Channel::DequeueSender () {
+    timerwheel_t::timer* next;
+    while ( (next=send_queue.pop(NOW)) ) {
+        Channel* sender = channel(next->owner);
+        if (sender)
+            return sender;
+    }
+    return NULL;
+}
+
+
 void    Channel::Loop (tint howlong) {
 
     tint limit = Datagram::Time() + howlong;
 
     do {
 
-        tint send_time(TINT_NEVER);
-        Channel* sender(NULL);
-        while (!sender && !send_queue.is_empty()) { // dequeue
-            tintbin next = send_queue.pop();
-            sender = channel((int)next.bin);
-            send_time = next.time;
-            if (sender && sender->next_send_time_!=send_time &&
-                     sender->next_send_time_!=TINT_NEVER )
-                sender = NULL; // it was a stale entry
-        }
-
-        if ( sender!=NULL && send_time<=NOW ) { // it's time
-
-            dprintf("%s #%u sch_send %s\n",tintstr(),sender->id(),
-                    tintstr(send_time));
-            sender->Send();
+        tint send_time = send_queue.next_time();
+
+        if ( send_time<=NOW ) { // it's time
+
+            // every channel due at this tick goes out in the same batch
+            Datagram::StartSendBatch();
+            int batched = 0;
+            Channel* sender;
+            while ( batched<DGRAM_SEND_BATCH && (sender=DequeueSender()) ) {
+                dprintf("%s #%u sch_send %s\n",tintstr(),sender->id(),
+                        tintstr(sender->next_send_time_));
+                int id = sender->id(), data_out = sender->data_out_.size();
+                sender->Send();
+                // with offload, a channel that sends DATA and is due again
+                // shortly sends right away, so its datagrams share a GSO buffer
+                int burst = 1;
+                while ( Datagram::offload && (sender=channel(id)) &&
+                        sender->data_out_.size()>data_out &&
+                        burst<DGRAM_GSO_SEGS && batched+burst<DGRAM_SEND_BATCH &&
+                        sender->next_send_time_<=NOW+SEND_BURST ) {
+                    data_out = sender->data_out_.size();
+                    sender->Send();
+                    burst++;
+                }
+                batched += burst;
+            }
+            Datagram::FlushSendBatch();
 
         } else {  // it's too early, wait
 
             tint towait = min(limit,send_time) - NOW;
             dprintf("%s #0 waiting %lliusec\n",tintstr(),(long long int)towait);
             Datagram::Wait(towait);
-            if (sender)  // get back to that later
-                send_queue.push(tintbin(send_time,sender->id()));
 
         }
 
@@ -577,7 +843,7 @@ void Channel::Reschedule () {
     next_send_time_ = NextSendTime();
     if (next_send_time_!=TINT_NEVER) {
         assert(next_send_time_<NOW+TINT_MIN);
-        send_queue.push(tintbin(next_send_time_,id_));
+        send_queue.schedule(&send_timer_,next_send_time_);
         dprintf("%s #%u requeue for %s\n",tintstr(),id_,tintstr(next_send_time_));
     } else {
         dprintf("%s #%u closed\n",tintstr(),id_);
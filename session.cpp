@@ -0,0 +1,226 @@
+/*
+ *  session.cpp
+ *  the path to a peer, shared by the channels of several transfers
+ *
+ *  Created by agent on 10/18/26.
+ *  Copyright 2026 agent. All rights reserved.
+ *
+ */
+#include "swift.h"
+
+using namespace swift;
+
+std::map<uint64_t,Session*> Session::sessions;
+std::list<Session::path_t> Session::paths;
+std::map<uint64_t,std::list<Session::path_t>::iterator> Session::path_index;
+int Session::PATH_CACHE_SIZE = 4096;
+tint Session::PATH_CACHE_TTL = TINT_MIN*10;
+
+
+Session::Session (const Address& peer) :
+    peer_(peer), payload_(Datagram::PathPayload(peer)), channel_count_(0),
+    slots_used_(0), slot_cursor_(0),
+    tags_in_(false), acks_head_(NULL), acks_tail_(NULL),
+    rtt_avg_(TINT_SEC), dev_avg_(0), cwnd_(1), senders_(0), slow_start_(false),
+    controller_(NULL), control_(NULL),
+    last_loss_time_(0), last_recv_time_(0), stable_cwnd_(1), stable_time_(0),
+    warm_cwnd_(1), warm_(false), dip_avg_(TINT_SEC), owd_min_bin_(0),
+    owd_min_bin_start_(NOW), owd_cur_bin_(0)
+{
+    for(int i=0; i<4; i++) {
+        owd_min_bins_[i] = TINT_NEVER;
+        owd_current_[i] = TINT_NEVER;
+    }
+    LoadPath();
+}
+
+
+Session::~Session () {
+    delete controller_;
+}
+
+
+Session*    Session::Find (const Address& peer) {
+    std::map<uint64_t,Session*>::iterator i = sessions.find(peer.key());
+    return i==sessions.end() ? NULL : i->second;
+}
+
+
+Session*    Session::Join (const Address& peer, Channel* channel) {
+    Session* s = Find(peer);
+    if (!s) {
+        s = new Session(peer);
+        sessions[peer.key()] = s;
+    }
+    s->channel_count_++;
+    channel->session_ = s;
+    channel->tag_ = NO_TAG;
+    channel->peer_tag_ = NO_TAG;
+    channel->ack_prev_ = channel->ack_next_ = NULL;
+    int slot;
+    if (s->slots_used_<s->slots_.size()) {
+        while (s->slots_[s->slot_cursor_])
+            s->slot_cursor_ = (s->slot_cursor_+1) % s->slots_.size();
+        slot = s->slot_cursor_;
+        s->slot_cursor_ = (slot+1) % s->slots_.size();
+    } else if (s->slots_.size()<(1<<TAG_SLOT_BITS)-1) { // the last one is NO_TAG's
+        slot = s->slots_.size();
+        s->slots_.push_back(NULL);
+        s->slot_gens_.push_back(0);
+    } else
+        return s; // the channel goes untagged, sends its own datagrams
+    s->slots_[slot] = channel;
+    s->slots_used_++;
+    channel->tag_ = (s->slot_gens_[slot]<<TAG_SLOT_BITS) | slot;
+    return s;
+}
+
+
+void    Session::Leave (Channel* channel) {
+    UnlinkAcks(channel);
+    if (channel->tag_!=NO_TAG) {
+        int slot = channel->tag_ & ((1<<TAG_SLOT_BITS)-1);
+        slots_[slot] = NULL;
+        slot_gens_[slot] = (slot_gens_[slot]+1) & ((1<<(16-TAG_SLOT_BITS))-1);
+        slots_used_--;
+    }
+    if (channel->peer_tag_!=NO_TAG)
+        peer_slots_[channel->peer_tag_&((1<<TAG_SLOT_BITS)-1)] = NULL;
+    if (channel->is_sending())
+        senders_--;
+    if (--channel_count_==0) {
+        SavePath();
+        sessions.erase(peer_.key());
+        delete this;
+    }
+}
+
+
+Channel*    Session::tagged (uint16_t tag) const {
+    int slot = tag & ((1<<TAG_SLOT_BITS)-1);
+    if (slot>=peer_slots_.size() || !peer_slots_[slot] ||
+            peer_slots_[slot]->peer_tag_!=tag)
+        return NULL;
+    return peer_slots_[slot];
+}
+
+
+void    Session::Bind (uint16_t tag, Channel* channel) {
+    int slot = tag & ((1<<TAG_SLOT_BITS)-1);
+    if (channel->peer_tag_!=NO_TAG) // rebound
+        peer_slots_[channel->peer_tag_&((1<<TAG_SLOT_BITS)-1)] = NULL;
+    if (slot>=peer_slots_.size())
+        peer_slots_.resize(slot+1,NULL);
+    if (peer_slots_[slot]) // the peer has reused the slot
+        peer_slots_[slot]->peer_tag_ = NO_TAG;
+    peer_slots_[slot] = channel;
+    channel->peer_tag_ = tag;
+    tags_in_ = true;
+}
+
+
+void    Session::LinkAcks (Channel* channel) {
+    if (channel->ack_prev_ || acks_head_==channel)
+        return; // linked already
+    channel->ack_next_ = NULL;
+    channel->ack_prev_ = acks_tail_;
+    if (acks_tail_)
+        acks_tail_->ack_next_ = channel;
+    else
+        acks_head_ = channel;
+    acks_tail_ = channel;
+}
+
+
+void    Session::UnlinkAcks (Channel* channel) {
+    if (!channel->ack_prev_ && acks_head_!=channel)
+        return; // not linked
+    if (channel->ack_prev_)
+        channel->ack_prev_->ack_next_ = channel->ack_next_;
+    else
+        acks_head_ = channel->ack_next_;
+    if (channel->ack_next_)
+        channel->ack_next_->ack_prev_ = channel->ack_prev_;
+    else
+        acks_tail_ = channel->ack_prev_;
+    channel->ack_prev_ = channel->ack_next_ = NULL;
+}
+
+
+void    Session::Control (CongestionControlFactory factory) {
+    if (controller_ && control_==factory)
+        return;
+    delete controller_;
+    controller_ = factory();
+    control_ = factory;
+}
+
+
+tint    Session::queueing_delay () const {
+    tint owd_cur(TINT_NEVER), owd_min(TINT_NEVER);
+    for(int i=0; i<4; i++) {
+        if (owd_min>owd_min_bins_[i])
+            owd_min = owd_min_bins_[i];
+        if (owd_cur>owd_current_[i])
+            owd_cur = owd_current_[i];
+    }
+    if (owd_cur==TINT_NEVER || owd_min==TINT_NEVER)
+        return TINT_NEVER;
+    return owd_cur - owd_min;
+}
+
+
+void    Session::SavePath () {
+    if (rtt_avg_==TINT_SEC && dev_avg_==0)
+        return; // learnt nothing
+    std::map<uint64_t,std::list<path_t>::iterator>::iterator i =
+        path_index.find(peer_.key());
+    if (i!=path_index.end())
+        paths.erase(i->second);
+    path_t path;
+    path.key = peer_.key();
+    path.time = NOW;
+    path.rtt_avg = rtt_avg_;
+    path.dev_avg = dev_avg_;
+    path.owd_min = TINT_NEVER;
+    for(int b=0; b<4; b++)
+        if (owd_min_bins_[b]<path.owd_min)
+            path.owd_min = owd_min_bins_[b];
+    path.dip_avg = dip_avg_;
+    // a window from long ago says nothing
+    path.cwnd = stable_time_>NOW-PATH_CACHE_TTL ? stable_cwnd_ : 1;
+    paths.push_front(path);
+    path_index[path.key] = paths.begin();
+    while (paths.size()>PATH_CACHE_SIZE) {
+        path_index.erase(paths.back().key);
+        paths.pop_back();
+    }
+}
+
+
+void    Session::LoadPath () {
+    std::map<uint64_t,std::list<path_t>::iterator>::iterator i =
+        path_index.find(peer_.key());
+    if (i==path_index.end())
+        return;
+    const path_t& path = *i->second;
+    if (path.time<NOW-PATH_CACHE_TTL) { // stale; it is the oldest, too
+        while (paths.back().key!=path.key) {
+            path_index.erase(paths.back().key);
+            paths.pop_back();
+        }
+        path_index.erase(i);
+        paths.pop_back();
+        return;
+    }
+    rtt_avg_ = path.rtt_avg;
+    dev_avg_ = path.dev_avg;
+    owd_min_bins_[owd_min_bin_] = path.owd_min;
+    dip_avg_ = path.dip_avg;
+    stable_cwnd_ = warm_cwnd_ = path.cwnd;
+    stable_time_ = path.time;
+    dprintf("%s #0 path %s rtt %lli dev %lli cwnd %.2f\n",tintstr(),
+            peer_.str(),(long long int)rtt_avg_,(long long int)dev_avg_,warm_cwnd_);
+    paths.erase(i->second); // the session has it now
+    path_index.erase(i);
+}
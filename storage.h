@@ -7,6 +7,8 @@
 
 namespace swift {
 
+    /** Data is addressed in bytes; the chunk size, and so the offset of
+        a bin, is up to the HashTree. */
     class DataStorage {
     public:
         //DataStorage( const Sha1Hash& id, size_t size ); //?
@@ -14,14 +16,10 @@ namespace swift {
         virtual size_t read( char* buf, size_t len ) = 0;
         /// read from given position
         virtual size_t read( off_t pos, char* buf, size_t len ) = 0;
-        /// read from given position
-        virtual size_t read( bin64_t pos, char* buf, size_t len ) = 0;
         /// write to start or where last non-positional write or read ended
         virtual size_t write( const char* buf, size_t len) = 0;
         /// write to given position
         virtual size_t write( off_t pos, const char* buf, size_t len ) = 0;
-        /// write to given position
-        virtual size_t write( bin64_t pos, const char* buf, size_t len ) = 0;
         virtual size_t size() = 0;
         virtual bool setSize( size_t len ) = 0;
         virtual bool valid() = 0;
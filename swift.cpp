@@ -14,7 +14,7 @@
 using namespace swift;
 
 #define quit(...) {fprintf(stderr,__VA_ARGS__); exit(1); }
-SOCKET InstallHTTPGateway (Address addr);
+SOCKET InstallHTTPGateway (Address addr, uint32_t chunk_size);
 
 
 int main (int argc, char** argv) {
@@ -30,6 +30,11 @@ int main (int argc, char** argv) {
         {"progress",no_argument, 0, 'p'},
         {"http",    optional_argument, 0, 'g'},
         {"wait",    optional_argument, 0, 'w'},
+        {"offload", no_argument, 0, 'o'},
+        {"uring",   no_argument, 0, 'u'},
+        {"shards",  required_argument, 0, 's'},
+        {"chunk",   required_argument, 0, 'z'},
+        {"cc",      required_argument, 0, 'c'},
         {0, 0, 0, 0}
     };
 
@@ -40,11 +45,13 @@ int main (int argc, char** argv) {
     Address tracker;
     Address http_gw;
     tint wait_time = 0;
+    int shards = 1, shard = 0;
+    uint32_t chunk_size = SWIFT_DEFAULT_CHUNK_SIZE;
     
     LibraryInit();
     
     int c;
-    while ( -1 != (c = getopt_long (argc, argv, ":h:f:dl:t:Dpg::w::", long_options, 0)) ) {
+    while ( -1 != (c = getopt_long (argc, argv, ":h:f:dl:t:Dpg::w::ous:z:c:", long_options, 0)) ) {
         
         switch (c) {
             case 'h':
@@ -100,10 +107,47 @@ int main (int argc, char** argv) {
                 } else
                     wait_time = TINT_NEVER;
                 break;
+            case 'o':
+                Datagram::offload = true;
+                break;
+            case 'u':
+                if (Datagram::SelectBackend(Datagram::URING_BACKEND)!=Datagram::URING_BACKEND)
+                    fprintf(stderr,"no io_uring here, using %s\n",
+                            Datagram::BACKEND_NAMES[Datagram::backend]);
+                break;
+            case 's':
+                if (sscanf(optarg,"%i",&shards)!=1 || shards<1)
+                    quit("number of shards must be a positive integer\n");
+                break;
+            case 'z':
+                if (sscanf(optarg,"%u",&chunk_size)!=1 || !chunk_size ||
+                    chunk_size>SWIFT_MAX_CHUNK_SIZE)
+                    quit("chunk size must be 1 to %i bytes\n",SWIFT_MAX_CHUNK_SIZE);
+                break;
+            case 'c':
+                if (!strcmp(optarg,"ledbat"))
+                    FileTransfer::DEFAULT_CONGESTION_CONTROL = NewLedbatController;
+                else if (!strcmp(optarg,"aimd"))
+                    FileTransfer::DEFAULT_CONGESTION_CONTROL = NewAimdController;
+                else if (!strcmp(optarg,"cubic"))
+                    FileTransfer::DEFAULT_CONGESTION_CONTROL = NewCubicController;
+                else
+                    quit("congestion control is ledbat, aimd or cubic\n");
+                break;
         }
 
     }   // arguments parsed
     
+    FileTransfer* ft = NULL;
+    if (shards>1) { // hash once, then fork; the shards share the tree
+        if (bindaddr==Address() || !filename || tracker!=Address() ||
+            http_gw!=Address())
+            quit("shards are for seeding a file: -f and -l, no -t or -g\n");
+        ft = Open(filename,root_hash,chunk_size);
+        if (!ft || !IsComplete(ft))
+            quit("cannot seed file %s",filename);
+        shard = Shard(shards);
+    }
 
     if (bindaddr!=Address()) { // seeding
         if (Listen(bindaddr)<=0)
@@ -122,18 +166,18 @@ int main (int argc, char** argv) {
         SetTracker(tracker);
 
     if (http_gw!=Address())
-        InstallHTTPGateway(http_gw);
+        InstallHTTPGateway(http_gw,chunk_size);
 
     if (root_hash!=Sha1Hash::ZERO && !filename)
         filename = strdup(root_hash.hex().c_str());
 
-    FileTransfer* ft = NULL;
-    if (filename) {
-        ft = Open(filename,root_hash);
+    if (filename && !ft) {
+        ft = Open(filename,root_hash,chunk_size);
         if (!ft)
             quit("cannot open file %s",filename);
-        printf("Root hash: %s\n", RootMerkleHash(ft).hex().c_str());
     }
+    if (ft && !shard)
+        printf("Root hash: %s\n", RootMerkleHash(ft).hex().c_str());
 
     if (bindaddr==Address() && ft==NULL && http_gw==Address()) {
         fprintf(stderr,"Usage:\n");
@@ -145,6 +189,11 @@ int main (int argc, char** argv) {
         fprintf(stderr,"  -p, --progress\treport transfer progress\n");
         fprintf(stderr,"  -g, --http\t[ip:|host:]port to bind HTTP gateway to (default localhost:8080)\n");
         fprintf(stderr,"  -w, --wait\tlimit running time, e.g. 1[DHMs] (default: infinite with -l, -g)\n");
+        fprintf(stderr,"  -o, --offload\tuse UDP segmentation offload (GSO/GRO) if the kernel has it\n");
+        fprintf(stderr,"  -u, --uring\twait for socket events with io_uring instead of epoll\n");
+        fprintf(stderr,"  -s, --shards\tnumber of processes to seed from, sharing the port (default: 1)\n");
+        fprintf(stderr,"  -z, --chunk\tchunk size in bytes, part of the root hash identity (default: %i)\n",SWIFT_DEFAULT_CHUNK_SIZE);
+        fprintf(stderr,"  -c, --cc\tcongestion control: ledbat, aimd or cubic (default: ledbat)\n");
         return 1;
     }
 
@@ -156,11 +205,15 @@ int main (int argc, char** argv) {
         if (report_progress && ft) {
             fprintf(stderr,
                     "%s %lli of %lli (seq %lli) %lli dgram %lli bytes up, "\
-                    "%lli dgram %lli bytes down\n",
+                    "%lli dgram %lli bytes down, %.1f dgram/wakeup, "\
+                    "%lli dropped\n",
                 IsComplete(ft) ? "DONE" : "done",
                 Complete(ft), Size(ft), SeqComplete(ft),
                 Datagram::dgrams_up, Datagram::bytes_up,
-                Datagram::dgrams_down, Datagram::bytes_down );
+                Datagram::dgrams_down, Datagram::bytes_down,
+                Datagram::recv_batches ?
+                    (double)Datagram::dgrams_down/Datagram::recv_batches : 0.0,
+                Datagram::dgrams_dropped );
         }
     }
     
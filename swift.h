@@ -17,8 +17,15 @@ Messages
  initial handshake packet also has the root hash
  (a HASH message).
 
+ CHUNK_SIZE    0a, size_32
+ The chunk size of the transmission, in bytes; goes
+ before the HANDSHAKE, both ways. A root hash means
+ nothing without the chunk size, so a peer refuses a
+ handshake with a size different from its own. Not
+ sent for the default 1K chunks.
+
  DATA        01, bin_32, buffer
- 1K of data.
+ A chunk of data (1K by default).
 
  ACK        02, bin_32, timestamp_32
  HAVE       03, bin_32
@@ -50,6 +57,8 @@ Messages
 #define SWIFT_H
 
 #include <deque>
+#include <list>
+#include <map>
 #include <vector>
 #include <algorithm>
 #include <string>
@@ -57,6 +66,7 @@ Messages
 #include "bins.h"
 #include "datagram.h"
 #include "hashtree.h"
+#include "timerwheel.h"
 
 namespace swift {
 
@@ -105,6 +115,69 @@ namespace swift {
         }
     };
 
+    /** A double-ended queue of tintbins in a ring buffer; the first few
+        entries are kept inline, so a mostly idle channel allocates
+        nothing. The buffer doubles when full and halves when mostly
+        empty. */
+    class tbring {
+    public:
+        static const int INLINE = 2;
+        tbring () : buf_(inline_), cap_(INLINE), head_(0), size_(0) {}
+        ~tbring () { if (buf_!=inline_) delete [] buf_; }
+        int     size () const { return size_; }
+        bool    empty () const { return size_==0; }
+        /** Bytes allocated outside the object. */
+        int     heap_bytes () const
+            { return buf_==inline_ ? 0 : cap_*sizeof(tintbin); }
+        tintbin&    operator [] (int i) { return buf_[(head_+i)&(cap_-1)]; }
+        tintbin&    front () { return buf_[head_]; }
+        tintbin&    back () { return (*this)[size_-1]; }
+        void    push_back (const tintbin& tb) {
+            if (size_==cap_)
+                resize(cap_<<1);
+            (*this)[size_++] = tb;
+        }
+        void    push_front (const tintbin& tb) {
+            if (size_==cap_)
+                resize(cap_<<1);
+            head_ = (head_-1)&(cap_-1);
+            buf_[head_] = tb;
+            size_++;
+        }
+        void    pop_front () {
+            head_ = (head_+1)&(cap_-1);
+            size_--;
+            if (cap_>INLINE && size_<cap_/4)
+                resize(cap_>>1);
+        }
+        void    pop_back () {
+            size_--;
+            if (cap_>INLINE && size_<cap_/4)
+                resize(cap_>>1);
+        }
+        void    clear () {
+            head_ = size_ = 0;
+            if (cap_>INLINE)
+                resize(INLINE);
+        }
+    private:
+        tintbin*    buf_;
+        int         cap_, head_, size_;
+        tintbin     inline_[INLINE];
+        void    resize (int cap) {
+            tintbin* buf = cap>INLINE ? new tintbin[cap] : inline_;
+            for(int i=0; i<size_; i++)
+                buf[i] = (*this)[i];
+            if (buf_!=inline_)
+                delete [] buf_;
+            buf_ = buf;
+            cap_ = cap;
+            head_ = 0;
+        }
+        tbring (const tbring&);
+        tbring& operator = (const tbring&);
+    };
+
     /** swift protocol message types; these are used on the wire. */
     typedef enum {
         SWIFT_HANDSHAKE = 0,
@@ -117,14 +190,20 @@ namespace swift {
         SWIFT_SIGNED_HASH = 7,
         SWIFT_HINT = 8,
         SWIFT_MSGTYPE_RCVD = 9,
-        SWIFT_MESSAGE_COUNT = 10
+        SWIFT_CHUNK_SIZE = 10,
+        SWIFT_TRANSFER = 11,
+        SWIFT_TRANSFER_INDEX = 12,
+        SWIFT_MESSAGE_COUNT = 13
     } messageid_t;
 
     class PiecePicker;
     class CongestionController;
     class PeerSelector;
     class FileTransfer;
+    class Session;
+    class Channel;
     typedef void (*ProgressCallback) (FileTransfer* ft , bin64_t bin);
+    typedef CongestionController* (*CongestionControlFactory) ();
 
 
     /** A class representing single file transfer. */
@@ -135,9 +214,12 @@ namespace swift {
         /** A constructor. Open/submit/retrieve a file.
          *  @param file_name    the name of the file
          *  @param root_hash    the root hash of the file; zero hash if the file
-                                is newly submitted */
-        FileTransfer(const char *file_name, const Sha1Hash& root_hash=Sha1Hash::ZERO);
-        FileTransfer(DataStorage* data_storage, const Sha1Hash& root_hash=Sha1Hash::ZERO, HashStorage* hash_storage = NULL);
+                                is newly submitted
+         *  @param chunk_size   the chunk size the root hash is for */
+        FileTransfer(const char *file_name, const Sha1Hash& root_hash=Sha1Hash::ZERO,
+                     uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE);
+        FileTransfer(DataStorage* data_storage, const Sha1Hash& root_hash=Sha1Hash::ZERO, HashStorage* hash_storage = NULL,
+                     uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE);
 
         /**    Close everything. */
         ~FileTransfer();
@@ -145,13 +227,19 @@ namespace swift {
 
         /** While we need to feed ACKs to every peer, we try (1) avoid
             unnecessary duplication and (2) keep minimum state. Thus,
-            we use a rotating queue of bin completion events. */
-        //bin64_t         RevealAck (uint64_t& offset);
-        /** Rotating queue read for channels of this transmission. */
-        int             RevealChannel (int& i);
-
-        /** Find transfer by the root hash. */
-        static FileTransfer* Find (const Sha1Hash& hash);
+            we use a rotating queue of bin completion events. Returns the
+            event at the offset and moves the offset on; NONE once there
+            are no more events, ALL if the queue has rotated past the
+            offset (the reader then has to catch up some other way). */
+        bin64_t         RevealAck (uint64_t& offset);
+        /** The next channel of this transfer to tell the peer of the
+            given one about, in the order of joining; moves that channel's
+            PEX cursor on. NULL if there is none yet. */
+        Channel*        RevealChannel (Channel* to);
+
+        /** Find transfer by the root hash and the chunk size. */
+        static FileTransfer* Find (const Sha1Hash& hash,
+                                   uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE);
         /** Find transfer by the file descriptor. */
         static FileTransfer* file (int fd) {
             return fd<files.size() ? files[fd] : NULL;
@@ -162,7 +250,7 @@ namespace swift {
         /** Piece picking strategy used by this transfer. */
         PiecePicker&    picker () { return *picker_; }
         /** The number of channels working for this transfer. */
-        int             channel_count () const { return hs_in_.size(); }
+        int             channel_count () const { return channel_count_; }
         /** Hash tree checked file; all the hashes and data are kept here. */
         HashTree&       file() { return file_; }
         /** Data storage for the data file. */
@@ -173,6 +261,20 @@ namespace swift {
         void AddProgressCallback (ProgressCallback cb,uint8_t agg);
         void RemoveProgressCallback (ProgressCallback cb);
 
+        /** Congestion control for the channels of this transfer: the
+            factory of the controllers, DEFAULT_CONGESTION_CONTROL unless
+            set (see CongestionController). The window to a peer is shared
+            by the transfers, so the choice holds for a peer if a channel
+            of this transfer is the first to send to it; otherwise the one
+            in place is kept, see Session::controller(). */
+        CongestionControlFactory congestion_control () const {
+            return congestion_control_;
+        }
+        void            SetCongestionControl (CongestionControlFactory factory) {
+            congestion_control_ = factory;
+        }
+        static CongestionControlFactory DEFAULT_CONGESTION_CONTROL;
+
     private:
 
         static std::vector<FileTransfer*> files;
@@ -183,10 +285,15 @@ namespace swift {
 
         /** Piece picker strategy. */
         PiecePicker*    picker_;
-
-        /** Channels working for this transfer. */
-        binqueue        hs_in_;
-        int             hs_in_offset_;
+        CongestionControlFactory congestion_control_;
+
+        /** Channels working for this transfer, in the order of joining;
+            the list is linked through the channels. */
+        Channel*        channels_head_;
+        Channel*        channels_tail_;
+        int             channel_count_;
+        /** Channels ever joined; numbers them in the list. */
+        uint64_t        channels_joined_;
         std::deque<Address> pex_in_;
 
         /** Messages we are accepting.    */
@@ -194,6 +301,13 @@ namespace swift {
 
         tint            init_time_;
 
+        /** The rotating queue of completion events: covering bins, the
+            oldest one being number ack_log_start_ (that is 1 and up, so
+            an offset of 0 is always behind). */
+        #define SWFT_ACK_LOG_SIZE 1024
+        binqueue        ack_log_;
+        uint64_t        ack_log_start_;
+
         #define SWFT_MAX_TRANSFER_CB 8
         ProgressCallback callbacks[SWFT_MAX_TRANSFER_CB];
         uint8_t         cb_agg[SWFT_MAX_TRANSFER_CB];
@@ -203,6 +317,7 @@ namespace swift {
         void            initialize();
 
     public:
+        /** Data was retrieved (and checked); log the event. */
         void            OnDataIn (bin64_t pos);
         void            OnPexIn (const Address& addr);
 
@@ -211,7 +326,8 @@ namespace swift {
         friend bool             IsComplete (FileTransfer* trans);
         friend uint64_t         Complete (FileTransfer* trans);
         friend uint64_t         SeqComplete (FileTransfer* trans);
-        friend FileTransfer*    Open (const char* filename, const Sha1Hash& hash) ;
+        friend FileTransfer*    Open (const char* filename, const Sha1Hash& hash,
+                                      uint32_t chunk_size) ;
         friend void             Close (FileTransfer* trans) ;
         friend void             ExternallyRetrieved (int transfer,bin64_t piece);
     };
@@ -242,6 +358,168 @@ namespace swift {
     };
 
 
+    /** CongestionController grows and shrinks the congestion window of a
+        session on the acknowledgements and losses of the data its channels
+        send. Slow start is common to all controllers; one takes over as it
+        ends. The window is shared by the transfers to the peer, so it is
+        under one controller at a time: that of the transfer whose channel
+        started sending first. */
+    class CongestionController {
+    public:
+        virtual const char* name () const = 0;
+        /** Slow start is over (or skipped, the path being known) at the
+            given window. */
+        virtual void  Start (const Session& path, float cwnd) {}
+        /** The window as of now; acked is the number of chunks acked since
+            the last call, maybe none. */
+        virtual float Update (const Session& path, float cwnd, int acked) = 0;
+        /** The window after a loss; called once an RTT at most. */
+        virtual float OnLoss (const Session& path, float cwnd) = 0;
+        virtual ~CongestionController() {}
+    };
+
+    /** The controllers at hand: LEDBAT (the default) keeps the queueing
+        delay it adds at LEDBAT_TARGET, yielding to other traffic; AIMD is
+        the standard TCP one; CUBIC regrows the window by the time since
+        the last loss, filling a long fat path much faster, which is good
+        for foreground downloads. */
+    CongestionController*   NewLedbatController ();
+    CongestionController*   NewAimdController ();
+    CongestionController*   NewCubicController ();
+
+
+    /** The path to a peer, shared by the channels to it (one per transfer):
+        the RTT and one-way delay estimates and the congestion window, so a
+        transfer joining a busy session starts at the session's pace rather
+        than with a handshake RTT guess and a window of one. Each channel has
+        a compact index in the session, told to the peer with the handshake
+        in a SWIFT_TRANSFER_INDEX message; a datagram may then carry messages
+        for several transfers, those of each one after a SWIFT_TRANSFER
+        message with the receiver's index for it. A session is opened by its
+        first channel and closed along with the last one; what it learnt of
+        the path is then kept for a while for the next session to the peer
+        (see PATH_CACHE_SIZE). */
+    class Session {
+    public:
+        /** The session to the peer, opened if there is none yet; the
+            channel is indexed (if there is a free index) and counted. */
+        static Session* Join (const Address& peer, Channel* channel);
+        /** The channel leaves the session; the last one closes it. */
+        void        Leave (Channel* channel);
+        static Session* Find (const Address& peer);
+
+        const Address& peer () const { return peer_; }
+        int         channel_count () const { return channel_count_; }
+        tint        rtt () const { return rtt_avg_; }
+        /** The largest datagram the path takes, UDP payload bytes; looked
+            up once, as the session opens. */
+        int         payload () const { return payload_; }
+        /** The congestion window, for all the channels sending. */
+        float       cwnd () const { return cwnd_; }
+        /** The latest one-way delay over the least one seen lately;
+            TINT_NEVER if there are no samples yet. */
+        tint        queueing_delay () const;
+        /** The window was started off the cached path, not slow start. */
+        bool        warm () const { return warm_; }
+        /** The controller of the window; NULL until a channel sends data. */
+        CongestionController* controller () const { return controller_; }
+        /** The channel the peer tags with the index; NULL if none. */
+        Channel*    tagged (uint16_t tag) const;
+        /** The peer tags the channel with the index from now on. */
+        void        Bind (uint16_t tag, Channel* channel);
+
+        /** An index is a slot number with a few bits counting the reuses
+            of the slot on top, so a stray message for a former channel
+            does not reach a new one. */
+        static const int TAG_SLOT_BITS = 12;
+        static const uint16_t NO_TAG = 0xffff;
+
+        /** Paths of closed sessions remembered, the least recently used
+            ones forgotten first, and for how long a path holds. */
+        static int  PATH_CACHE_SIZE;
+        static tint PATH_CACHE_TTL;
+
+    private:
+        Session (const Address& peer);
+        ~Session ();
+
+        Address     peer_;
+        int         payload_;
+        int         channel_count_;
+        /** Our channels by the slot of their index, with the reuse counts;
+            free slots are taken round robin from the cursor on. */
+        std::vector<Channel*> slots_;
+        std::vector<uint8_t>  slot_gens_;
+        int         slots_used_;
+        int         slot_cursor_;
+        /** The peer's indices of our channels, by slot. */
+        std::vector<Channel*> peer_slots_;
+        /** The peer tags its messages, so it reads tags as well. */
+        bool        tags_in_;
+        /** Channels with data to acknowledge, linked through them: any
+            datagram to the peer may carry their ACKs. */
+        Channel*    acks_head_;
+        Channel*    acks_tail_;
+        /** Smoothed RTT and RTT deviation of the path. */
+        tint        rtt_avg_, dev_avg_;
+        /** Congestion window, chunks in flight for all the channels; split
+            among the channels sending data, senders_ in number. */
+        float       cwnd_;
+        int         senders_;
+        /** The window is new: from the first of the senders starting
+            it (in slow start, unless warm) until any sender goes on to
+            congestion avoidance, when the controller is started. */
+        bool        slow_start_;
+        /** The controller of the window and the factory it came from. */
+        CongestionController* controller_;
+        CongestionControlFactory control_;
+        tint        last_loss_time_;
+        tint        last_recv_time_;
+        /** The window last seen out of slow start, and when; kept for the
+            next session to the peer. */
+        float       stable_cwnd_;
+        tint        stable_time_;
+        /** The window the previous session to the peer left: the first
+            channel to send data starts off it. A pause within a session
+            is followed by slow start though, as the peer's hints may
+            have run out (and imposed data may be duplicate). */
+        float       warm_cwnd_;
+        bool        warm_;
+        /** Data interarrival period last seen by any channel. */
+        tint        dip_avg_;
+        /** LEDBAT one-way delay machinery */
+        tint        owd_min_bins_[4];
+        int         owd_min_bin_;
+        tint        owd_min_bin_start_;
+        tint        owd_current_[4];
+        int         owd_cur_bin_;
+
+        void        LinkAcks (Channel* channel);
+        void        UnlinkAcks (Channel* channel);
+        /** Put the window under a controller from the factory, unless it
+            is already. */
+        void        Control (CongestionControlFactory factory);
+        /** Remember the path on closing; seed the estimates from it on
+            opening, if it is there and fresh. */
+        void        SavePath ();
+        void        LoadPath ();
+
+        /** Sessions by the peer's address key. */
+        static std::map<uint64_t,Session*> sessions;
+        /** The path cache, most recently used first, and its index. */
+        struct path_t {
+            uint64_t    key;
+            tint        time;
+            tint        rtt_avg, dev_avg, owd_min, dip_avg;
+            float       cwnd;
+        };
+        static std::list<path_t> paths;
+        static std::map<uint64_t,std::list<path_t>::iterator> path_index;
+
+        friend class Channel;
+    };
+
+
     /**    swift channel's "control block"; channels loosely correspond to TCP
         connections or FTP sessions; one channel is created for one file
         being transferred between two peers. As we don't need buffers and
@@ -251,19 +529,26 @@ namespace swift {
     public:
         Channel    (FileTransfer* file, int socket=INVALID_SOCKET, Address peer=Address());
         ~Channel();
+        /** Channels come from slabs of SLAB_CHANNELS; a freed one is
+            reused by the next channel. */
+        static void* operator new (size_t size);
+        static void  operator delete (void* p);
+        static const int SLAB_CHANNELS = 64;
 
         typedef enum {
             KEEP_ALIVE_CONTROL,
             PING_PONG_CONTROL,
             SLOW_START_CONTROL,
-            AIMD_CONTROL,
-            LEDBAT_CONTROL,
+            CONG_AVOID_CONTROL,
             CLOSE_CONTROL
         } send_control_t;
 
         static const char* SEND_CONTROL_MODES[];
 
+        /** Drains a batch of datagrams from the socket and feeds them
+            to their channels. */
         static void RecvDatagram (SOCKET socket);
+        static void DispatchDatagram (Datagram& dgram);
         static void Loop (tint till);
 
         void        Recv (Datagram& dgram);
@@ -277,24 +562,52 @@ namespace swift {
         void        OnHash (Datagram& dgram);
         void        OnPex (Datagram& dgram);
         void        OnHandshake (Datagram& dgram);
+        void        OnChunkSize (Datagram& dgram);
+        /** A SWIFT_TRANSFER message: returns the channel the rest of the
+            datagram is for, NULL if unknown. */
+        Channel*    OnTransfer (Datagram& dgram);
+        /** A SWIFT_TRANSFER_INDEX message: the peer's index for this
+            channel. */
+        void        OnTransferIndex (Datagram& dgram);
         void        AddHandshake (Datagram& dgram);
         bin64_t     AddData (Datagram& dgram);
+        /** Put the DATA message for the chunk along with the hashes needed
+            to check it; if those do not fit, the datagram is sent and a
+            new one started, unless may_flush is false (then the chunk is
+            not packed, false returned). */
+        bool        PackData (Datagram& dgram, bin64_t pos, bool may_flush);
         void        AddAck (Datagram& dgram);
         void        AddHave (Datagram& dgram);
         void        AddHint (Datagram& dgram);
         void        AddUncleHashes (Datagram& dgram, bin64_t pos);
         void        AddPeakHashes (Datagram& dgram);
         void        AddPex (Datagram& dgram);
+        /** Put the ACKs other channels of the session owe the peer, each
+            after a SWIFT_TRANSFER message, as long as they fit. */
+        void        AddSessionAcks (Datagram& dgram);
 
-        void        BackOffOnLosses (float ratio=0.5);
+        void        BackOffOnLosses ();
         tint        SwitchSendControl (int control_mode);
         tint        NextSendTime ();
         tint        KeepAliveNextSendTime ();
         tint        PingPongNextSendTime ();
         tint        CwndRateNextSendTime ();
         tint        SlowStartNextSendTime ();
-        tint        AimdNextSendTime ();
-        tint        LedbatNextSendTime ();
+        /** Past slow start, the session's controller runs the window. */
+        tint        CongAvoidNextSendTime ();
+        /** When the data received is to be acked: NOW once MAX_DELAYED_ACKS
+            chunks wait, otherwise a bit after the first one arrived. */
+        tint        AckDueTime ();
+        /** This channel's share of the session's congestion window. */
+        float       cwnd () const {
+            int senders = session_->senders_ + (is_sending() ? 0 : 1);
+            return session_->cwnd_ / senders;
+        }
+        /** In one of the modes sending data by the congestion window. */
+        bool        is_sending () const {
+            return send_control_==SLOW_START_CONTROL ||
+                   send_control_==CONG_AVOID_CONTROL;
+        }
 
         static int  MAX_REORDERING;
         static tint TIMEOUT;
@@ -305,6 +618,14 @@ namespace swift {
         static tint LEDBAT_DELAY_BIN;
         static bool SELF_CONN_OK;
         static tint MAX_POSSIBLE_RTT;
+        /** A channel may send that much ahead of its schedule to pack
+            several chunks into a datagram or, with segmentation offload,
+            several datagrams into a burst. */
+        static tint SEND_BURST;
+        /** An ACK waits for more data no longer than that (or a quarter of
+            the RTT) and for no more than that many chunks. */
+        static tint MAX_ACK_DELAY;
+        static int  MAX_DELAYED_ACKS;
         static FILE* debug_file;
 
         const std::string id_string () const;
@@ -313,19 +634,45 @@ namespace swift {
         FileTransfer& transfer() { return *transfer_; }
         HashTree&   file () { return transfer_->file(); }
         const Address& peer() const { return peer_; }
+        Session&    session () { return *session_; }
+        /** The RTT estimates are the session's; an idle channel is lax
+            about timeouts, as if the deviation were an RTT or a second. */
         tint ack_timeout () {
-			tint dev = dev_avg_ < MIN_DEV ? MIN_DEV : dev_avg_;
-			tint tmo = rtt_avg_ + dev * 4;
+			tint dev = session_->dev_avg_ < MIN_DEV ? MIN_DEV : session_->dev_avg_;
+			if (send_control_==KEEP_ALIVE_CONTROL)
+				dev = std::max(dev,std::max(TINT_SEC,session_->rtt_avg_));
+			tint tmo = session_->rtt_avg_ + dev * 4;
 			return tmo < 30*TINT_SEC ? tmo : 30*TINT_SEC;
         }
         uint32_t    id () const { return id_; }
+        /** Memory taken by the channel: the object and whatever its queues,
+            binmaps and indices allocated. */
+        size_t      footprint () const;
 
         static int  DecodeID(int scrambled);
         static int  EncodeID(int unscrambled);
         static Channel* channel(int i) {
             return i<channels.size()?channels[i]:NULL;
         }
+        /** Slots of closed channels are reused, so the id the peer knows
+            carries the slot's generation in the top bits; a datagram or
+            a reference meant for the previous channel in the slot then
+            finds nothing. */
+        static const int ID_BITS = 24;
+        uint32_t    tagged_id () const {
+            return ((uint32_t)generations[id_]<<ID_BITS) | id_;
+        }
+        static Channel* tagged_channel (uint32_t tagged) {
+            uint32_t i = tagged & ((1<<ID_BITS)-1);
+            if (i>=channels.size() || generations[i]!=(tagged>>ID_BITS))
+                return NULL;
+            return channels[i];
+        }
         static void CloseTransfer (FileTransfer* trans);
+        /** The first channel of the transfer to the address, or the next
+            one after the given one; NULL if there is none. */
+        static Channel* PeerChannel (const Address& addr, FileTransfer* ft,
+                                     Channel* after=NULL);
 
         static const Address& Tracker() { return tracker; }
 
@@ -337,6 +684,14 @@ namespace swift {
         uint32_t    id_;
         /**    Socket address of the peer. */
         Address     peer_;
+        /**    The path to the peer, shared with the other transfers; our
+               and the peer's index of this channel in it. */
+        Session*    session_;
+        uint16_t    tag_;
+        uint16_t    peer_tag_;
+        /**    Neighbours in the session's list of channels owing ACKs. */
+        Channel*    ack_prev_;
+        Channel*    ack_next_;
         /**    The UDP socket fd. */
         SOCKET      socket_;
         /**    Descriptor of the file in question. */
@@ -346,37 +701,69 @@ namespace swift {
         bool        own_id_mentioned_;
         /**    Peer's progress, based on acknowledgements. */
         binmap_t        ack_in_;
-        /**    Last data received; needs to be acked immediately. */
-        tintbin     data_in_;
+        /**    Data sent along with its uncle hashes, less the lost one; the
+               peer has the hashes on the way up from any of it. */
+        binmap_t        hash_out_;
+        /**    Data received and not acked yet, in the order of arrival; a
+               few chunks are let to pile up for one ACK (see AckDueTime). */
+        tbring      data_in_;
         bin64_t     data_in_dbl_;
-        /** The history of data sent and still unacknowledged. */
-        tbqueue     data_out_;
-        /** Timeouted data (potentially to be retransmitted). */
-        tbqueue     data_out_tmo_;
-        bin64_t     data_out_cap_;
+        /** The history of data sent and still unacknowledged, in the
+            order of sending; the entry at i has the sequence number
+            data_out_seq_+i. Acked and lost entries are left as holes
+            until they reach the front. */
+        tbring      data_out_;
+        uint64_t    data_out_seq_;
+        /** The sequence numbers of the data in flight, by bin; ordered,
+            as an ACK may cover a range. */
+        std::map<bin64_t,uint64_t>  data_out_idx_;
+        /** The latest entry of data_out_ acked by the datagram being read,
+            -1 if none; the entries well before it are taken for lost. */
+        int         data_out_acked_;
+        /** Timeouted data (potentially to be retransmitted), oldest first;
+            the index has the latest timeout of each bin. */
+        tbring      data_out_tmo_;
+        std::map<bin64_t,tint>      data_out_tmo_idx_;
         /** Index in the history array. */
         binmap_t        have_out_;
-        /**    Transmit schedule: in most cases filled with the peer's hints */
-        tbqueue     hint_in_;
+        /** Read offset in the transfer's queue of completion events. */
+        uint64_t        have_out_offset_;
+        /**    Transmit schedule: in most cases filled with the peer's hints;
+               a hint is served from the left, the rest of it staying in
+               the queue as a few bins. */
+        tbring      hint_in_;
+        uint64_t    hint_in_size_;
         /** Hints sent (to detect and reschedule ignored hints). */
-        tbqueue     hint_out_;
+        tbring      hint_out_;
         uint64_t    hint_out_size_;
+        /** The chunks of hint_out_, to tell data that was not hinted
+            without a scan. */
+        binmap_t    hint_out_map_;
         /** Types of messages the peer accepts. */
         uint64_t    cap_in_;
         /** For repeats. */
         //tint        last_send_time, last_recv_time;
-        /** PEX progress */
-        int         pex_out_;
-        /** Smoothed averages for RTT, RTT deviation and data interarrival periods. */
-        tint        rtt_avg_, dev_avg_, dip_avg_;
+        /** Neighbours in the transfer's list of channels, and the number
+            of joining. */
+        Channel*    transfer_prev_;
+        Channel*    transfer_next_;
+        uint64_t    join_seq_;
+        /** PEX progress: the last channel of the transfer passed by (its
+            tagged id) and its number of joining, should it close. */
+        uint32_t    pex_out_;
+        uint64_t    pex_out_seq_;
+        /** The next channel in the same bucket of the peer index. */
+        Channel*    peer_next_;
+        /** Smoothed average of data interarrival periods; RTT estimates
+            are the session's. */
+        tint        dip_avg_;
         tint        last_send_time_;
         tint        last_recv_time_;
         tint        last_data_out_time_;
         tint        last_data_in_time_;
-        tint        last_loss_time_;
         tint        next_send_time_;
-        /** Congestion window; TODO: int, bytes. */
-        float       cwnd_;
+        /** This channel's entry in the send queue. */
+        timerwheel_t::timer send_timer_;
         /** Data sending interval. */
         tint        send_interval_;
         /** The congestion control strategy. */
@@ -387,34 +774,52 @@ namespace swift {
         int         ack_rcvd_recent_;
         /** Recent non-acknowlegements (losses) of data previously sent.    */
         int         ack_not_rcvd_recent_;
-        /** LEDBAT one-way delay machinery */
-        tint        owd_min_bins_[4];
-        int         owd_min_bin_;
-        tint        owd_min_bin_start_;
-        tint        owd_current_[4];
-        int         owd_cur_bin_;
         /** Stats */
         int         dgrams_sent_;
         int         dgrams_rcvd_;
 
         int         PeerBPS() const {
-            return TINT_SEC / dip_avg_ * 1024;
+            return TINT_SEC / dip_avg_ * transfer_->file().chunk_size();
         }
         /** Get a request for one packet from the queue of peer's requests. */
         bin64_t     DequeueHint();
         bin64_t     ImposeHint();
         void        TimeoutDataOut ();
+        /** Drop the front entry of data_out_, unindexing it. */
+        void        PopDataOut ();
+        /** Take an entry of data_out_ for lost. */
+        void        LoseDataOut (int i);
+        /** Once all the ACKs in a datagram are read: losses by reordering,
+            then the acked entries are cleared off data_out_. */
+        void        CleanDataOut ();
         void        CleanStaleHintOut();
         void        CleanHintOut(bin64_t pos);
         void        Reschedule();
+        /** Pop the next channel due to send by now, if any. */
+        static Channel* DequeueSender ();
 
         static PeerSelector* peer_selector;
 
         static tint     last_tick;
-        static tbheap   send_queue;
+        static timerwheel_t send_queue;
 
         static Address  tracker;
         static std::vector<Channel*> channels;
+        /** Per slot, bumped when the channel in it is closed. */
+        static std::vector<uint8_t> generations;
+        /** Free slots, oldest first: the longer a slot rests, the less
+            likely it is to get stray datagrams for a former channel. */
+        static std::deque<uint32_t> free_ids;
+        /** Free slab slots, linked through their first word. */
+        static void*    free_slots;
+        /** Per socket, the local receive drops already set against
+            losses (see BackOffOnLosses). */
+        static std::map<SOCKET,uint32_t> drops_counted;
+        /** Channels by peer address and transfer: a hash table chained
+            through the channels, twice as large as it gets full. */
+        static std::vector<Channel*> peer_index;
+        static int      peer_indexed;
+        static Channel*& PeerBucket (const Address& addr, const FileTransfer* ft);
 
         // Statistics
         static uint64_t totalBytesRead_;
@@ -424,7 +829,9 @@ namespace swift {
         friend void             Shutdown (int sock_des);
         friend void             AddPeer (Address address, const Sha1Hash& root);
         friend void             SetTracker(const Address& tracker);
-        friend FileTransfer*    Open (const char*, const Sha1Hash&) ; // FIXME
+        friend FileTransfer*    Open (const char*, const Sha1Hash&, uint32_t) ; // FIXME
+        friend class FileTransfer;
+        friend class Session;
 
     };
 
@@ -433,6 +840,14 @@ namespace swift {
     /*************** The top-level API ****************/
     /** Start listening a port. Returns socket descriptor. */
     int     Listen (Address addr);
+    /** Fork into count processes (shards) before Listen(); each binds the
+        same port with SO_REUSEPORT and runs its own loop, send queue and
+        channel table, while the kernel pins every peer to one shard by its
+        address. Transfers opened before the fork are shared copy-on-write,
+        so this is meant for seeding. Returns the shard number, 0 for the
+        original process, which reaps the others as they exit; they die
+        with it. */
+    int     Shard (int count);
     /** Run send/receive loop for the specified amount of time. */
     void    Loop (tint till);
     bool    Listen3rdPartySocket (sckrwecb_t);
@@ -440,8 +855,10 @@ namespace swift {
     void    Shutdown (int sock_des=-1);
 
     /** Open a file, start a transmission; fill it with content for a given root hash;
-        in case the hash is omitted, the file is a fresh submit. */
-    FileTransfer*   Open (const char* filename, const Sha1Hash& hash=Sha1Hash::ZERO) ;
+        in case the hash is omitted, the file is a fresh submit. The root hash
+        is only valid with the chunk size it was made with. */
+    FileTransfer*   Open (const char* filename, const Sha1Hash& hash=Sha1Hash::ZERO,
+                          uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE) ;
     /** Get the root hash for the transmission. */
     const Sha1Hash& RootMerkleHash (FileTransfer* ft);
     /** Close a file and a transmission. */
@@ -453,7 +870,7 @@ namespace swift {
 
     void    SetTracker(const Address& tracker);
 
-    /** Returns size of the file in bytes, 0 if unknown. Might be rounded up to a kilobyte
+    /** Returns size of the file in bytes, 0 if unknown. Might be rounded up to a chunk
         before the transmission is complete. */
     uint64_t  Size (FileTransfer* trans);
     /** Returns the amount of retrieved and verified data, in bytes.
@@ -464,7 +881,7 @@ namespace swift {
         beginning, till the first not-yet-retrieved packet. */
     uint64_t  SeqComplete (FileTransfer* trans);
     /***/
-    FileTransfer*   Find (Sha1Hash hash);
+    FileTransfer*   Find (Sha1Hash hash, uint32_t chunk_size=SWIFT_DEFAULT_CHUNK_SIZE);
 
     void ExternallyRetrieved (FileTransfer* transfer,bin64_t piece);
 
@@ -10,8 +10,6 @@ using namespace swift;
 #define OPENFLAGS         O_RDWR|O_CREAT
 #endif
 
-#define POS2OFFSET(pos)     (pos.base_offset()<<10)
-
 FileOffsetDataStorage::FileOffsetDataStorage( const char* filename, size_t offset, unsigned int repeat ) : offset_(offset), size_(0), fullsize_(0), cur_(0), fd_(0), filename_(0), repeat_(repeat) {
     fd_ = open( filename , OPENFLAGS, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH );
     if( fd_ < 0 ) {
@@ -94,10 +92,6 @@ size_t FileOffsetDataStorage::read( off_t pos, char* buf, size_t len ) {
     offsetOperation( pread )
 }
 
-size_t FileOffsetDataStorage::read( bin64_t pos, char* buf, size_t len ) {
-    return read( POS2OFFSET( pos ), buf, len );
-}
-
 size_t FileOffsetDataStorage::write( const char* buf, size_t len ) {
     int ret = write( cur_, buf, len );
     if( ret < 0 )
@@ -110,10 +104,6 @@ size_t FileOffsetDataStorage::write( off_t pos, const char* buf, size_t len ) {
     offsetOperation( pwrite )
 }
 
-size_t FileOffsetDataStorage::write( bin64_t pos, const char* buf, size_t len ) {
-    return write( POS2OFFSET(pos), buf, len );
-}
-
 size_t FileOffsetDataStorage::size() {
     return fullsize_;
 }
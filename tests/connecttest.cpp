@@ -53,6 +53,167 @@ TEST(Connection,CwndTest) {
 }
 
 
+/** A seeder may hold lots of channels doing nothing; sizeof(Channel+members)
+    is meant to stay below 1K for those. */
+TEST(Connection,IdleChannelFootprint) {
+
+    FileTransfer* fileobj = swift::Open("doc/sofi.jpg");
+    ASSERT_TRUE(fileobj!=NULL);
+    const int count = 1000, tracker = fileobj->channel_count();
+    size_t total = 0;
+    for(int i=0; i<count; i++) {
+        Channel* channel = new Channel(fileobj,INVALID_SOCKET,
+                                       Address("127.0.0.1",20000+i));
+        total += channel->footprint();
+    }
+    printf("%i idle channels: %lu bytes per channel, sizeof(Channel) %lu\n",
+           count,(unsigned long)(total/count),(unsigned long)sizeof(Channel));
+    EXPECT_LT(total/count,1024u);
+    EXPECT_EQ(tracker+count,fileobj->channel_count());
+    // the peer index has been rehashed a few times meanwhile
+    for(int i=0; i<count; i+=37) {
+        Address addr("127.0.0.1",20000+i);
+        Channel* channel = Channel::PeerChannel(addr,fileobj);
+        ASSERT_TRUE(channel!=NULL);
+        EXPECT_TRUE(channel->peer()==addr);
+        EXPECT_TRUE(NULL==Channel::PeerChannel(addr,fileobj,channel));
+    }
+    EXPECT_TRUE(NULL==Channel::PeerChannel(Address("127.0.0.1",20000+count),fileobj));
+	swift::Close(fileobj);
+
+}
+
+
+TEST(Connection,RecycledIds) {
+
+    FileTransfer* fileobj = swift::Open("doc/sofi.jpg");
+    ASSERT_TRUE(fileobj!=NULL);
+    Channel* first = new Channel(fileobj,INVALID_SOCKET,Address("127.0.0.1",7101));
+    uint32_t id = first->id(), tagged = first->tagged_id();
+    EXPECT_TRUE(first==Channel::tagged_channel(tagged));
+    delete first;
+    EXPECT_TRUE(NULL==Channel::tagged_channel(tagged));
+    // the slot is reused once all the older free ones are
+    Channel* next = NULL;
+    do {
+        next = new Channel(fileobj,INVALID_SOCKET,Address("127.0.0.1",7102));
+    } while (next->id()!=id);
+    EXPECT_NE(tagged,next->tagged_id());
+    EXPECT_TRUE(NULL==Channel::tagged_channel(tagged));
+    EXPECT_TRUE(next==Channel::tagged_channel(next->tagged_id()));
+	swift::Close(fileobj);
+
+}
+
+
+/** Transfers between the same two peers share one session: the RTT, the
+    window and, tagged, datagrams; a later session to the peer starts
+    with what this one learnt of the path. */
+TEST(Connection,SessionTransfers) {
+
+    const char* files[2] = {"doc/sofi.jpg","doc/cc-states.png"};
+    const char* copies[2] = {"doc/sofi-copy.jpg","doc/cc-states-copy.png"};
+    Channel::SELF_CONN_OK = true;
+    int sock = swift::Listen(7002);
+    ASSERT_TRUE(sock>=0);
+    Address addr("127.0.0.1",7002);
+    swift::SetTracker(addr);
+    FileTransfer *orig[2], *copy[2];
+    for(int i=0; i<2; i++) {
+        unlink(copies[i]);
+        orig[i] = swift::Open(files[i]);
+        ASSERT_TRUE(orig[i]!=NULL);
+    }
+    for(int i=0; i<2; i++)
+        copy[i] = swift::Open(copies[i],orig[i]->root_hash());
+    Session* session = Session::Find(addr);
+    ASSERT_TRUE(session!=NULL);
+    int count = 0;
+    while ( (!swift::IsComplete(copy[0]) || !swift::IsComplete(copy[1])) &&
+            count++<600 ) {
+        swift::Loop(TINT_SEC/10);
+        EXPECT_TRUE(session==Session::Find(addr));
+    }
+    EXPECT_TRUE(swift::IsComplete(copy[0]));
+    EXPECT_TRUE(swift::IsComplete(copy[1]));
+    printf("%i channels in the session\n",session->channel_count());
+    EXPECT_LE(4,session->channel_count());
+    ASSERT_TRUE(session->controller()!=NULL);
+    EXPECT_STREQ("ledbat",session->controller()->name());
+    for(int i=0; i<2; i++) {
+        swift::Close(orig[i]);
+        swift::Close(copy[i]);
+    }
+    EXPECT_TRUE(NULL==Session::Find(addr)); // closed with the last channel
+    // the next session to the peer starts off the path learnt
+    FileTransfer* again = swift::Open(files[0]);
+    Channel* channel = Channel::PeerChannel(addr,again);
+    ASSERT_TRUE(channel!=NULL);
+    EXPECT_LT(channel->ack_timeout(),TINT_SEC);
+    // and the window it left; with no delay samples yet, LEDBAT keeps it
+    Session* path = Session::Find(addr);
+    ASSERT_TRUE(path!=NULL);
+    channel->SwitchSendControl(Channel::SLOW_START_CONTROL);
+    EXPECT_TRUE(path->warm());
+    EXPECT_TRUE(TINT_NEVER==path->queueing_delay());
+    float cwnd = path->cwnd();
+    printf("warm start at %.2f\n",cwnd);
+    EXPECT_LT(1,cwnd);
+    channel->CongAvoidNextSendTime();
+    EXPECT_FLOAT_EQ(cwnd,path->cwnd());
+    swift::Close(again);
+	swift::Shutdown(sock);
+    for(int i=0; i<2; i++) {
+        unlink(copies[i]);
+        unlink((std::string(copies[i])+".mhash").c_str());
+    }
+
+}
+
+
+/** On a long fat path (an RTT of a second here), CUBIC regains the window
+    lost in a few seconds, where AIMD would take a minute. */
+TEST(Connection,CubicRegrowth) {
+
+    FileTransfer* fileobj = swift::Open("doc/sofi.jpg");
+    ASSERT_TRUE(fileobj!=NULL);
+    EXPECT_TRUE(fileobj->congestion_control()==FileTransfer::DEFAULT_CONGESTION_CONTROL);
+    fileobj->SetCongestionControl(NewCubicController);
+    Channel* channel = new Channel(fileobj,INVALID_SOCKET,Address("127.0.0.1",7201));
+    const Session& path = channel->session();
+    EXPECT_TRUE(NULL==path.controller()); // no data sent yet
+    ASSERT_EQ(TINT_SEC,path.rtt());
+    CongestionController* cc[2] = {NewCubicController(),NewAimdController()};
+    float cwnd[2], acks[2] = {0,0};
+    const tint now = NOW;
+    for(int i=0; i<2; i++) {
+        cc[i]->Start(path,100);
+        cwnd[i] = cc[i]->OnLoss(path,100);
+    }
+    EXPECT_FLOAT_EQ(70,cwnd[0]);
+    EXPECT_FLOAT_EQ(50,cwnd[1]);
+    for(tint t=0; t<TINT_SEC*8; t+=TINT_MSEC*10) {
+        NOW = now + t;
+        for(int i=0; i<2; i++) { // a window acked an RTT
+            acks[i] += cwnd[i] / 100;
+            int acked = (int)acks[i];
+            acks[i] -= acked;
+            cwnd[i] = cc[i]->Update(path,cwnd[i],acked);
+        }
+        if (t==TINT_SEC*3)
+            EXPECT_GT(100,cwnd[0]); // flattens out near the old window
+    }
+    printf("cwnd 8s after a loss: cubic %.1f, aimd %.1f\n",cwnd[0],cwnd[1]);
+    EXPECT_LT(100,cwnd[0]); // and probes beyond it
+    EXPECT_GT(60,cwnd[1]);
+    NOW = now;
+    for(int i=0; i<2; i++)
+        delete cc[i];
+    swift::Close(fileobj);
+
+}
+
+
 int main (int argc, char** argv) {
 
 	swift::LibraryInit();
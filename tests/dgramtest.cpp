@@ -103,6 +103,109 @@ TEST(Datagram,TwoPortTest) {
 	Datagram::Close(sock2);
 }
 
+int reads = 0;
+
+void CountRead (SOCKET sock) {
+	Datagram recv(sock);
+	if (recv.Recv()==4 && recv.Pull32()==1234)
+		reads++;
+}
+
+TEST(Datagram,BackendTest) {
+	for(int b=Datagram::SELECT_BACKEND; b<=Datagram::URING_BACKEND; b++) {
+		Datagram::backend_t got = Datagram::SelectBackend((Datagram::backend_t)b);
+		ASSERT_TRUE(got<=b);
+		if (got!=b)
+			continue; // the kernel has no such thing
+		reads = 0;
+		int sock1 = Datagram::Bind("0.0.0.0:10003");
+		int sock2 = Datagram::Bind("0.0.0.0:10004",sckrwecb_t(0,CountRead));
+		ASSERT_TRUE(sock1>0);
+		ASSERT_TRUE(sock2>0);
+		for(int i=0; i<3; i++) {
+			Datagram send(sock1,Address("127.0.0.1:10004"));
+			send.Push32(1234);
+			send.Send();
+			for(int w=0; w<10 && reads<=i; w++)
+				Datagram::Wait(100000);
+			EXPECT_EQ(i+1,reads) << Datagram::BACKEND_NAMES[b];
+		}
+		Datagram::Wait(10000); // nothing more to read
+		EXPECT_EQ(3,reads) << Datagram::BACKEND_NAMES[b];
+		Datagram::Shutdown();
+	}
+	Datagram::SelectBackend();
+}
+
+TEST(Datagram,ArrivalTimeTest) {
+	int sock = Datagram::Bind("0.0.0.0:10005");
+	ASSERT_TRUE(sock>0);
+	Datagram send(sock,Address("127.0.0.1:10005"));
+	send.Push32(1234);
+	tint sent = Datagram::Time();
+	send.Send();
+	usleep(100000); // the datagram waits in the socket buffer
+	Datagram recv[1];
+	ASSERT_EQ(1,Datagram::Recv(sock,recv,1));
+	EXPECT_GE(recv[0].arrival_time(),sent);
+	EXPECT_LE(recv[0].arrival_time(),Datagram::now);
+#ifdef SO_TIMESTAMPNS
+	EXPECT_LT(recv[0].arrival_time(),Datagram::now-TINT_MSEC*50);
+#endif
+	Datagram::Close(sock);
+}
+
+TEST(Datagram,OverflowTest) {
+	int sock = Datagram::Bind("0.0.0.0:10006");
+	ASSERT_TRUE(sock>0);
+	EXPECT_EQ(0,Datagram::RecvDrops(sock));
+	int sent = 0;
+	for(int i=0; i<20000; i++) { // way more than the buffer holds
+		Datagram send(sock,Address("127.0.0.1:10006"));
+		send.Push32(i);
+		uint8_t fill[1000];
+		memset(fill,i,1000);
+		send.Push(fill,1000);
+		if (send.Send()>0)
+			sent++;
+	}
+	Datagram recv[DGRAM_RECV_BATCH];
+	int got = 0, r;
+	while ( (r=Datagram::Recv(sock,recv,DGRAM_RECV_BATCH)) )
+		got += r;
+	EXPECT_GT(got,0);
+#ifdef SO_RXQ_OVFL
+	// the drop count rides on datagrams queued after the drops
+	Datagram send(sock,Address("127.0.0.1:10006"));
+	send.Push32(0);
+	send.Send();
+	EXPECT_EQ(1,Datagram::Recv(sock,recv,DGRAM_RECV_BATCH));
+	// the count may lag a bit behind, never overshoot
+	EXPECT_GT(Datagram::RecvDrops(sock),0u);
+	EXPECT_LE(Datagram::RecvDrops(sock),sent-got);
+	EXPECT_GE(Datagram::dgrams_dropped,sent-got);
+	EXPECT_GT(Datagram::RecvDropTime(sock),0);
+#endif
+	Datagram::Close(sock);
+}
+
+TEST(Datagram,PathPayloadTest) {
+	int lo = Datagram::PathPayload(Address("127.0.0.1:10007"));
+	EXPECT_GE(lo,DGRAM_DEFAULT_MTU-28); // loopback MTUs are large
+	EXPECT_LE(lo,MAXDGRAMSZ);
+}
+
+TEST(Datagram,ClockTest) {
+	tint last = Datagram::Time();
+	EXPECT_LT(abs(last-usec_walltime()),TINT_SEC);
+	for(int i=0; i<100000; i++) {
+		tint t = Datagram::Time();
+		ASSERT_GE(t,last);
+		last = t;
+	}
+	EXPECT_EQ(last,Datagram::now);
+}
+
 int main (int argc, char** argv) {
 
 	swift::LibraryInit();
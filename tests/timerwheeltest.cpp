@@ -0,0 +1,163 @@
+/*
+ *  timerwheeltest.cpp
+ *  swift
+ *
+ *  Created by agent on 10/18/26.
+ *  Copyright 2026 agent. All rights reserved.
+ *
+ */
+#include <gtest/gtest.h>
+#include <map>
+#include "swift.h"
+
+using namespace swift;
+
+#ifdef _MSC_VER
+	#define RANDOM  rand
+#else
+	#define RANDOM	random
+#endif
+
+typedef timerwheel_t::timer wtimer;
+
+
+TEST(TimerWheelTest,ScheduleCancel) {
+    timerwheel_t wheel;
+    wtimer a(1), b(2), c(3);
+    tint now = TINT_SEC*1000;
+    EXPECT_EQ(TINT_NEVER,wheel.next_time());
+    wheel.schedule(&a,now+10);
+    wheel.schedule(&b,now+5);
+    wheel.schedule(&c,now+TINT_MIN);
+    EXPECT_EQ(3,wheel.size());
+    EXPECT_TRUE(NULL==wheel.pop(now));
+    EXPECT_EQ(now+5,wheel.next_time());
+    wheel.schedule(&b,now+20); // reschedule, no stale entry
+    EXPECT_EQ(3,wheel.size());
+    wheel.cancel(&c);
+    wheel.cancel(&c);
+    EXPECT_EQ(2,wheel.size());
+    EXPECT_TRUE(&a==wheel.pop(now+15));
+    EXPECT_TRUE(NULL==wheel.pop(now+15));
+    EXPECT_TRUE(&b==wheel.pop(now+TINT_SEC));
+    EXPECT_TRUE(wheel.is_empty());
+    EXPECT_FALSE(b.is_scheduled());
+}
+
+
+TEST(TimerWheelTest,AgainstMultimap) {
+    const int count = 1000;
+    timerwheel_t wheel;
+    std::vector<wtimer> timers(count);
+    std::multimap<tint,int> ref;
+    std::vector<std::multimap<tint,int>::iterator> where(count,ref.end());
+    tint now = TINT_SEC*1000000;
+    for(int i=0; i<count; i++)
+        timers[i].owner = i;
+    for(int round=0; round<100000; round++) {
+        int i = RANDOM()%count;
+        if (where[i]!=ref.end())
+            ref.erase(where[i]);
+        if (RANDOM()%8==0) {
+            wheel.cancel(&timers[i]);
+            where[i] = ref.end();
+        } else {
+            // from the same tick to hours and days ahead
+            tint ahead = RANDOM() % (1<<(RANDOM()%31));
+            if (RANDOM()%100==0)
+                ahead *= TINT_SEC;
+            wheel.schedule(&timers[i],now+ahead);
+            where[i] = ref.insert(std::make_pair(now+ahead,i));
+        }
+        ASSERT_EQ((int)ref.size(),wheel.size());
+        now += RANDOM()%(1<<(RANDOM()%20));
+        if (RANDOM()%1000==0)
+            now += TINT_HOUR*100;
+        wtimer* t;
+        while ( (t=wheel.pop(now)) ) {
+            ASSERT_FALSE(ref.empty());
+            ASSERT_LE(t->time,now);
+            ASSERT_EQ(ref.begin()->first,t->time);
+            ref.erase(where[t->owner]);
+            where[t->owner] = ref.end();
+        }
+        ASSERT_TRUE(ref.empty() || ref.begin()->first>now);
+        if (!ref.empty()) {
+            ASSERT_GT(wheel.next_time(),now);
+            ASSERT_LE(wheel.next_time(),ref.begin()->first);
+        }
+    }
+}
+
+
+/** A send queue workout: every channel is popped when due and requeued
+    a bit later; one in four is also rescheduled by an incoming datagram
+    while waiting, which leaves a stale entry in the heap. */
+TEST(TimerWheelTest,SendQueueBenchmark) {
+    const int channels = 10000, rounds = 2000000;
+    std::vector<tint> next(channels);
+    std::vector<wtimer> timers(channels);
+    std::vector<long> intervals(rounds);
+    for(int r=0; r<rounds; r++)
+        intervals[r] = 1 + RANDOM()%(TINT_SEC/10);
+    const tint start = TINT_SEC*1000;
+
+    tbheap heap;
+    tint now = start;
+    for(int i=0; i<channels; i++) {
+        next[i] = now + intervals[i];
+        heap.push(tintbin(next[i],(uint64_t)i));
+    }
+    long heap_sends = 0;
+    tint heap_began = Datagram::Time();
+    for(int r=0; r<rounds; r++) {
+        tintbin tb = heap.pop();
+        int i = (int)tb.bin;
+        if (next[i]!=tb.time)
+            continue; // stale
+        now = tb.time;
+        heap_sends++;
+        next[i] = now + intervals[r];
+        heap.push(tintbin(next[i],(uint64_t)i));
+        if (r%4==0) {
+            int j = r%channels;
+            next[j] = now + intervals[(r+1)%rounds];
+            heap.push(tintbin(next[j],(uint64_t)j));
+        }
+    }
+    tint heap_took = Datagram::Time() - heap_began;
+    int heap_size = heap.size();
+
+    timerwheel_t wheel;
+    now = start;
+    for(int i=0; i<channels; i++) {
+        timers[i].owner = i;
+        wheel.schedule(&timers[i],now+intervals[i]);
+    }
+    long wheel_sends = 0;
+    tint wheel_began = Datagram::Time();
+    for(int r=0; r<rounds && wheel_sends<heap_sends; r++) {
+        wtimer* t;
+        while ( !(t=wheel.pop(wheel.next_time())) ); // cascade to the next one
+        now = t->time;
+        wheel_sends++;
+        wheel.schedule(t,now+intervals[r]);
+        if (r%4==0) {
+            int j = r%channels;
+            wheel.schedule(&timers[j],now+intervals[(r+1)%rounds]);
+        }
+    }
+    tint wheel_took = Datagram::Time() - wheel_began;
+
+    printf("%i channels, %li sends: tbheap %lliusec (%i entries), "
+           "timerwheel %lliusec (%i entries)\n",channels,heap_sends,
+           (long long)heap_took,heap_size,(long long)wheel_took,wheel.size());
+    EXPECT_EQ(heap_sends,wheel_sends);
+    EXPECT_EQ(channels,wheel.size());
+}
+
+
+int main (int argc, char** argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -95,7 +95,7 @@ TEST(TransferTest,TransferFile) {
         ASSERT_NE(bin64_t::NONE,next);
         ASSERT_TRUE(next.base_offset()<5);
         uint8_t buf[1024];         //size_t len = seed->storer->ReadData(next,&buf);
-        size_t len = seed->data_storage()->read(next,(char*)buf,1024);
+        size_t len = seed->data_storage()->read((off_t)seed->chunk_offset(next),(char*)buf,1024);
         bin64_t sibling = next.sibling();
         if (sibling.base_offset()<seed->packet_size())
             leech->OfferHash(sibling, seed->hash(sibling));
@@ -112,6 +112,88 @@ TEST(TransferTest,TransferFile) {
     EXPECT_EQ(4100,leech->seq_complete());
 
 }
+
+TEST(TransferTest,ChunkSize) {
+    unlink("chunky");
+    unlink("chunky.mhash");
+    unlink("chunky_copy");
+    unlink("chunky_copy.mhash");
+    char data[5000];
+    for(int i=0; i<5000; i++)
+        data[i] = 'a' + i%26;
+    int f = open("chunky",O_RDWR|O_CREAT|O_TRUNC,S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    ASSERT_EQ(5000,write(f,data,5000));
+    close(f);
+
+    FileTransfer* seed_transfer = new FileTransfer("chunky",Sha1Hash::ZERO,2048);
+    HashTree* seed = & seed_transfer->file();
+    EXPECT_EQ(2048,seed->chunk_size());
+    EXPECT_EQ(5000,seed->size());
+    EXPECT_EQ(3,seed->packet_size());
+    EXPECT_EQ(bin64_t(1,0),seed->peak(0));
+    EXPECT_TRUE(Sha1Hash(data+2048,2048)==seed->hash(bin64_t(0,1)));
+    EXPECT_TRUE(Sha1Hash(data+4096,904)==seed->hash(bin64_t(0,2)));
+    // the root hash with the other chunk size is some other file
+    EXPECT_TRUE(seed_transfer==FileTransfer::Find(seed->root_hash(),2048));
+    EXPECT_TRUE(NULL==FileTransfer::Find(seed->root_hash()));
+    EXPECT_TRUE(NULL==Open("chunky_copy",seed->root_hash(),SWIFT_MAX_CHUNK_SIZE+1));
+
+    unlink("chunky_copy");
+    FileTransfer* leech_transfer = new FileTransfer("chunky_copy",seed->root_hash(),2048);
+    HashTree* leech = & leech_transfer->file();
+    for(int i=0; i<seed->peak_count(); i++)
+        leech->OfferHash(seed->peak(i),seed->peak_hash(i));
+    ASSERT_EQ(3*2048,leech->size());
+    ASSERT_EQ(3,leech->packet_size());
+    leech->OfferHash(bin64_t(0,1),seed->hash(bin64_t(0,1)));
+    char buf[2048];
+    for(int i=0; i<3; i++) {
+        bin64_t pos(0,i);
+        size_t len = seed->data_storage()->read((off_t)seed->chunk_offset(pos),buf,2048);
+        EXPECT_EQ(i<2?2048:904,len);
+        if (i<2) // only the last chunk may be short
+            EXPECT_FALSE(leech->OfferData(pos,buf,len/2));
+        EXPECT_TRUE(leech->OfferData(pos,buf,len));
+    }
+    EXPECT_EQ(5000,leech->size());
+    EXPECT_EQ(5000,leech->complete());
+    EXPECT_TRUE(leech->is_complete());
+
+    delete leech_transfer;
+    delete seed_transfer;
+    unlink("chunky");
+    unlink("chunky.mhash");
+    unlink("chunky_copy");
+    unlink("chunky_copy.mhash");
+}
+
+TEST(TransferTest,AckLog) {
+    unlink("acklog");
+    FileTransfer* trans = new FileTransfer("acklog",
+        Sha1Hash(true,"0123456789abcdef0123456789abcdef01234567"));
+    uint64_t offset = 0, late = 0;
+    EXPECT_EQ(bin64_t::ALL,trans->RevealAck(offset));
+    offset = 1;
+    EXPECT_EQ(bin64_t::NONE,trans->RevealAck(offset));
+    ExternallyRetrieved(trans,bin64_t(0,0));
+    ExternallyRetrieved(trans,bin64_t(0,1)); // covered by (1,0) now
+    ExternallyRetrieved(trans,bin64_t(0,3));
+    late = offset;
+    EXPECT_EQ(bin64_t(0,0),trans->RevealAck(offset));
+    EXPECT_EQ(bin64_t(1,0),trans->RevealAck(offset));
+    EXPECT_EQ(bin64_t(0,3),trans->RevealAck(offset));
+    EXPECT_EQ(bin64_t::NONE,trans->RevealAck(offset));
+    EXPECT_EQ(4,offset);
+    for(int i=0; i<SWFT_ACK_LOG_SIZE; i++)
+        ExternallyRetrieved(trans,bin64_t(0,10+2*i));
+    EXPECT_EQ(bin64_t::ALL,trans->RevealAck(late)); // rotated out
+    EXPECT_EQ(1,late);
+    EXPECT_EQ(bin64_t(0,10),trans->RevealAck(offset));
+    delete trans;
+    unlink("acklog");
+    unlink("acklog.mhash");
+}
+
 /*
  FIXME
  - always rehashes (even fresh files)
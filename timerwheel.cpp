@@ -0,0 +1,177 @@
+/*
+ *  timerwheel.cpp
+ *  swift
+ *
+ *  Created by agent on 10/18/26.
+ *  Copyright 2026 agent. All rights reserved.
+ *
+ */
+#include "timerwheel.h"
+
+using namespace swift;
+
+
+static inline int lowest_bit (uint64_t x) {
+#ifdef __GNUC__
+    return __builtin_ctzll(x);
+#else
+    int i = 0;
+    while (!(x&1)) {
+        x >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+
+static inline int highest_bit (uint64_t x) {
+#ifdef __GNUC__
+    return 63-__builtin_clzll(x);
+#else
+    int i = 0;
+    while (x>>=1)
+        i++;
+    return i;
+#endif
+}
+
+
+timerwheel_t::timerwheel_t () : now_(0), size_(0) {
+    for(int l=0; l<LEVELS; l++)
+        occupied_[l] = 0;
+    for(int s=0; s<=FAR_SLOT; s++)
+        slots_[s] = NULL;
+}
+
+
+void    timerwheel_t::link (timer* t) {
+    uint64_t when = t->time<0 ? 0 : (uint64_t)t->time;
+    int s;
+    if (when<=now_) {
+        s = DUE_SLOT;
+    } else if ((when^now_)>=SPAN) {
+        s = FAR_SLOT;
+    } else {
+        // the highest bit that differs from now_ picks the level; within
+        // the level, the slot is always ahead of now_'s one
+        int level = highest_bit(when^now_) / LEVEL_BITS;
+        int slot = (when>>(level*LEVEL_BITS)) & (SLOTS-1);
+        s = level*SLOTS + slot;
+        occupied_[level] |= 1ULL<<slot;
+    }
+    t->slot_ = s;
+    t->next_ = slots_[s];
+    if (t->next_)
+        t->next_->pprev_ = &t->next_;
+    t->pprev_ = &slots_[s];
+    slots_[s] = t;
+    size_++;
+}
+
+
+void    timerwheel_t::unlink (timer* t) {
+    *t->pprev_ = t->next_;
+    if (t->next_)
+        t->next_->pprev_ = t->pprev_;
+    if (t->slot_<DUE_SLOT && !slots_[t->slot_])
+        occupied_[t->slot_/SLOTS] &= ~(1ULL<<(t->slot_%SLOTS));
+    t->next_ = NULL;
+    t->pprev_ = NULL;
+    t->slot_ = -1;
+    size_--;
+}
+
+
+void    timerwheel_t::schedule (timer* t, tint time) {
+    if (t->is_scheduled())
+        unlink(t);
+    t->time = time;
+    link(t);
+}
+
+
+void    timerwheel_t::cancel (timer* t) {
+    if (t->is_scheduled())
+        unlink(t);
+}
+
+
+int     timerwheel_t::next_slot (uint64_t* start) const {
+    if (slots_[DUE_SLOT]) {
+        *start = now_;
+        return DUE_SLOT;
+    }
+    for(int l=0; l<LEVELS; l++) {
+        if (!occupied_[l])
+            continue;
+        int shift = l*LEVEL_BITS;
+        int cur = (now_>>shift) & (SLOTS-1);
+        // level-0 timers may sit at the current tick; upper level ones
+        // are always strictly ahead of it
+        uint64_t ahead = l==0 ? ~0ULL<<cur :
+                         cur==SLOTS-1 ? 0 : ~0ULL<<(cur+1);
+        uint64_t mask = occupied_[l] & ahead;
+        if (!mask)
+            continue;
+        int slot = lowest_bit(mask);
+        uint64_t span = 1ULL<<(shift+LEVEL_BITS);
+        *start = (now_ & ~(span-1)) | ((uint64_t)slot<<shift);
+        return l*SLOTS + slot;
+    }
+    if (slots_[FAR_SLOT]) {
+        *start = (now_ & ~(SPAN-1)) + SPAN;
+        return FAR_SLOT;
+    }
+    return -1;
+}
+
+
+void    timerwheel_t::advance (uint64_t to) {
+    while (!slots_[DUE_SLOT]) {
+        uint64_t start;
+        int s = next_slot(&start);
+        if (s<0 || start>to) {
+            if (to>now_)
+                now_ = to;
+            return;
+        }
+        timer* list = slots_[s];
+        slots_[s] = NULL;
+        if (s<DUE_SLOT)
+            occupied_[s/SLOTS] &= ~(1ULL<<(s%SLOTS));
+        if (s==FAR_SLOT) {
+            // the wheel is otherwise empty: skip right to the earliest one
+            uint64_t earliest = to;
+            for(timer* t=list; t; t=t->next_)
+                if ((uint64_t)t->time<earliest)
+                    earliest = t->time;
+            now_ = earliest>start ? earliest : start;
+        } else
+            now_ = start;
+        while (list) { // cascade: re-file relative to the new now_
+            timer* t = list;
+            list = t->next_;
+            size_--;
+            link(t);
+        }
+    }
+}
+
+
+timerwheel_t::timer*    timerwheel_t::pop (tint now) {
+    if (now>0)
+        advance(now);
+    timer* t = slots_[DUE_SLOT];
+    if (t)
+        unlink(t);
+    return t;
+}
+
+
+tint    timerwheel_t::next_time () const {
+    uint64_t start;
+    if (next_slot(&start)<0)
+        return TINT_NEVER;
+    return start;
+}
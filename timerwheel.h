@@ -0,0 +1,82 @@
+/*
+ *  timerwheel.h
+ *  hierarchical timing wheel for the channel send schedule
+ *
+ *  Created by agent on 10/18/26.
+ *  Copyright 2026 agent. All rights reserved.
+ *
+ */
+#ifndef SWIFT_TIMERWHEEL_H
+#define SWIFT_TIMERWHEEL_H
+#include "compat.h"
+
+namespace swift {
+
+    /** A hierarchical timing wheel: LEVELS wheels of SLOTS slots each, one
+        microsecond per level-0 slot, so the wheel spans 2^36usec (~19 hours);
+        timers further ahead are parked on a side list and re-filed when the
+        wheel gets there. Timers are intrusive nodes owned by the caller, so
+        (re)scheduling and cancelling are O(1) and a rescheduled timer leaves
+        no stale entry behind. Expired timers are popped in time order; a
+        per-level occupancy bitmap lets the wheel jump over empty slots
+        instead of ticking through them. */
+    class timerwheel_t {
+    public:
+        static const int LEVEL_BITS = 6;
+        static const int SLOTS = 1<<LEVEL_BITS;
+        static const int LEVELS = 6;
+
+        /** A timer handle; embed it into the object being scheduled. */
+        struct timer {
+            tint    time;
+            int     owner;
+            timer() : time(TINT_NEVER), owner(-1), next_(NULL), pprev_(NULL),
+                      slot_(-1) {}
+            timer(int owner_) : time(TINT_NEVER), owner(owner_), next_(NULL),
+                                pprev_(NULL), slot_(-1) {}
+            bool    is_scheduled () const { return pprev_!=NULL; }
+        private:
+            timer*  next_;
+            timer** pprev_;
+            int     slot_; // level*SLOTS+slot, DUE_SLOT or FAR_SLOT
+            friend class timerwheel_t;
+        };
+
+        timerwheel_t ();
+
+        /** (Re)arm the timer to expire at the given time. */
+        void    schedule (timer* t, tint time);
+        /** Disarm the timer; a no-op if it is not scheduled. */
+        void    cancel (timer* t);
+        /** Pop the earliest timer due by now; NULL if none is. */
+        timer*  pop (tint now);
+        /** The earliest time a timer may expire; exact for timers less
+            than SLOTS usec away, a lower bound otherwise. TINT_NEVER if
+            the wheel is empty. */
+        tint    next_time () const;
+        int     size () const { return size_; }
+        bool    is_empty () const { return size_==0; }
+
+    private:
+        static const int DUE_SLOT = LEVELS*SLOTS;
+        static const int FAR_SLOT = LEVELS*SLOTS+1;
+        static const uint64_t SPAN = 1ULL<<(LEVEL_BITS*LEVELS);
+
+        uint64_t    now_;
+        int         size_;
+        uint64_t    occupied_[LEVELS];
+        timer*      slots_[LEVELS*SLOTS+2]; // plus the due and far lists
+
+        void    link (timer* t);
+        void    unlink (timer* t);
+        /** Find the next non-empty slot: returns its index (or -1) and
+            the time it starts at (a lower bound of its timers' times). */
+        int     next_slot (uint64_t* start) const;
+        /** Move the wheel towards the given time, cascading slots on the
+            way, until some timer becomes due. */
+        void    advance (uint64_t to);
+    };
+
+}
+
+#endif
@@ -16,19 +16,22 @@
 using namespace swift;
 
 std::vector<FileTransfer*> FileTransfer::files(20);
+CongestionControlFactory FileTransfer::DEFAULT_CONGESTION_CONTROL = NewLedbatController;
 
 #define BINHASHSIZE (sizeof(bin64_t)+sizeof(Sha1Hash))
 
 // FIXME: separate Bootstrap() and Download(), then Size(), Progress(), SeqProgress()
 
-FileTransfer::FileTransfer (const char* filename, const Sha1Hash& _root_hash) :
-    file_(filename,_root_hash), hs_in_offset_(0), cb_installed(0), files_index_(-1)
+FileTransfer::FileTransfer (const char* filename, const Sha1Hash& _root_hash, uint32_t chunk_size) :
+    file_(filename,_root_hash,(HashStorage*)NULL,chunk_size), channels_head_(NULL),
+    channels_tail_(NULL), channel_count_(0), channels_joined_(0), ack_log_start_(1), cb_installed(0), files_index_(-1)
 {
     initialize();
 }
 
-FileTransfer::FileTransfer (DataStorage* dataStorage, const Sha1Hash& root_hash, HashStorage* hashStorage) :
-    file_(dataStorage, root_hash, hashStorage), hs_in_offset_(0), cb_installed(0), files_index_(-1)
+FileTransfer::FileTransfer (DataStorage* dataStorage, const Sha1Hash& root_hash, HashStorage* hashStorage, uint32_t chunk_size) :
+    file_(dataStorage, root_hash, hashStorage, chunk_size), channels_head_(NULL),
+    channels_tail_(NULL), channel_count_(0), channels_joined_(0), ack_log_start_(1), cb_installed(0), files_index_(-1)
 {
     initialize();
 }
@@ -48,14 +51,14 @@ void FileTransfer::initialize() {
     files[files_index_] = this;
     picker_ = new SeqPiecePicker(this);
     picker_->Randomize(rand()&63);
+    congestion_control_ = DEFAULT_CONGESTION_CONTROL;
     init_time_ = Datagram::Time();
 }
 
 
 void    Channel::CloseTransfer (FileTransfer* trans) {
-    for(int i=0; i<Channel::channels.size(); i++) 
-        if (Channel::channels[i] && Channel::channels[i]->transfer_==trans) 
-            delete Channel::channels[i];
+    while (trans->channels_head_)
+        delete trans->channels_head_; // unlinks itself
 }
 
 
@@ -70,6 +73,25 @@ void swift::ExternallyRetrieved (FileTransfer* trans,bin64_t piece) {
     if (!trans)
         return;
     trans->ack_out().set(piece); // that easy
+    trans->OnDataIn(piece);
+}
+
+
+void FileTransfer::OnDataIn (bin64_t pos) {
+    ack_log_.push_back(ack_out().cover(pos));
+    if (ack_log_.size()>SWFT_ACK_LOG_SIZE) {
+        ack_log_.pop_front();
+        ack_log_start_++;
+    }
+}
+
+
+bin64_t FileTransfer::RevealAck (uint64_t& offset) {
+    if (offset<ack_log_start_)
+        return bin64_t::ALL;
+    if (offset>=ack_log_start_+ack_log_.size())
+        return bin64_t::NONE;
+    return ack_log_[offset++ - ack_log_start_];
 }
 
 
@@ -98,16 +120,17 @@ FileTransfer::~FileTransfer ()
 }
 
 
-FileTransfer* FileTransfer::Find (const Sha1Hash& root_hash) {
+FileTransfer* FileTransfer::Find (const Sha1Hash& root_hash, uint32_t chunk_size) {
     for(int i=0; i<files.size(); i++)
-        if (files[i] && files[i]->root_hash()==root_hash)
+        if (files[i] && files[i]->root_hash()==root_hash &&
+            files[i]->file().chunk_size()==chunk_size)
             return files[i];
     return NULL;
 }
 
 
-FileTransfer*       swift:: Find (Sha1Hash hash) {
-    FileTransfer* t = FileTransfer::Find(hash);
+FileTransfer*       swift:: Find (Sha1Hash hash, uint32_t chunk_size) {
+    FileTransfer* t = FileTransfer::Find(hash,chunk_size);
     if (t)
         return t;
     return NULL;
@@ -116,12 +139,9 @@ FileTransfer*       swift:: Find (Sha1Hash hash) {
 
 
 void            FileTransfer::OnPexIn (const Address& addr) {
-    for(int i=0; i<hs_in_.size(); i++) {
-        Channel* c = Channel::channel(hs_in_[i]);
-        if (c && c->transfer().files_index_==files_index_ && c->peer()==addr)
-            return; // already connected
-    }
-    if (hs_in_.size()<20) {
+    if (Channel::PeerChannel(addr,this))
+        return; // already connected
+    if (channel_count_<20) {
         new Channel(this,Datagram::default_socket(),addr);
     } else {
         pex_in_.push_back(addr);
@@ -131,25 +151,25 @@ void            FileTransfer::OnPexIn (const Address& addr) {
 }
 
 
-int        FileTransfer::RevealChannel (int& pex_out_) { // FIXME brainfuck
-    pex_out_ -= hs_in_offset_;
-    if (pex_out_<0)
-        pex_out_ = 0;
-    while (pex_out_<hs_in_.size()) {
-        Channel* c = Channel::channel(hs_in_[pex_out_]);
-        if (c && c->transfer().files_index_==files_index_) {
-            if (c->is_established()) {
-                pex_out_ += hs_in_offset_ + 1;
-                return c->id();
-            } else
-                pex_out_++;
-        } else {
-            hs_in_[pex_out_] = hs_in_[0];
-            hs_in_.pop_front();
-            hs_in_offset_++;
+Channel*    FileTransfer::RevealChannel (Channel* to) {
+    Channel* c = Channel::tagged_channel(to->pex_out_);
+    if (c) {
+        c = c->transfer_next_;
+    } else { // closed meanwhile (or none yet): go by the number of joining
+        c = channels_head_;
+        while (c && c->join_seq_<=to->pex_out_seq_)
+            c = c->transfer_next_;
+        if (!c) { // hold on to a live one, so as not to walk again
+            to->pex_out_ = channels_tail_->tagged_id();
+            to->pex_out_seq_ = channels_tail_->join_seq_;
         }
     }
-    pex_out_ += hs_in_offset_;
-    return -1;
+    for(; c; c=c->transfer_next_) {
+        to->pex_out_ = c->tagged_id();
+        to->pex_out_seq_ = c->join_seq_;
+        if (c!=to && c->is_established())
+            return c;
+    }
+    return NULL;
 }
 